@@ -0,0 +1,82 @@
+#include <iostream>
+
+#include "AsyncHttpService.h"
+#include "ClientError.h"
+
+using namespace std;
+
+Task AsyncHttpService::head(CoroutineScheduler *, HTTPRequest *request, HTTPResponse *, ResponseWriter *) {
+  cout << "HEAD " << request->getPath() << endl;
+  throw ClientError::methodNotAllowed();
+  co_return;
+}
+
+Task AsyncHttpService::get(CoroutineScheduler *, HTTPRequest *request, HTTPResponse *, ResponseWriter *) {
+  cout << "GET " << request->getPath() << endl;
+  throw ClientError::methodNotAllowed();
+  co_return;
+}
+
+Task AsyncHttpService::put(CoroutineScheduler *, HTTPRequest *request, HTTPResponse *, ResponseWriter *) {
+  cout << "PUT " << request->getPath() << endl;
+  throw ClientError::methodNotAllowed();
+  co_return;
+}
+
+Task AsyncHttpService::post(CoroutineScheduler *, HTTPRequest *request, HTTPResponse *, ResponseWriter *) {
+  cout << "POST " << request->getPath() << endl;
+  throw ClientError::methodNotAllowed();
+  co_return;
+}
+
+Task AsyncHttpService::del(CoroutineScheduler *, HTTPRequest *request, HTTPResponse *, ResponseWriter *) {
+  cout << "DELETE " << request->getPath() << endl;
+  throw ClientError::methodNotAllowed();
+  co_return;
+}
+
+Task AsyncHttpService::move(CoroutineScheduler *, HTTPRequest *request, HTTPResponse *, ResponseWriter *) {
+  cout << "MOVE " << request->getPath() << endl;
+  throw ClientError::methodNotAllowed();
+  co_return;
+}
+
+HttpServiceAdapter::HttpServiceAdapter(HttpService *service) {
+  m_service = service;
+}
+
+Task HttpServiceAdapter::head(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                              ResponseWriter *) {
+  HttpService *service = m_service;
+  co_await blocking(scheduler, [=]() { service->head(request, response); });
+}
+
+Task HttpServiceAdapter::get(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                             ResponseWriter *) {
+  HttpService *service = m_service;
+  co_await blocking(scheduler, [=]() { service->get(request, response); });
+}
+
+Task HttpServiceAdapter::put(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                             ResponseWriter *) {
+  HttpService *service = m_service;
+  co_await blocking(scheduler, [=]() { service->put(request, response); });
+}
+
+Task HttpServiceAdapter::post(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                              ResponseWriter *) {
+  HttpService *service = m_service;
+  co_await blocking(scheduler, [=]() { service->post(request, response); });
+}
+
+Task HttpServiceAdapter::del(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                             ResponseWriter *) {
+  HttpService *service = m_service;
+  co_await blocking(scheduler, [=]() { service->del(request, response); });
+}
+
+Task HttpServiceAdapter::move(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                              ResponseWriter *) {
+  HttpService *service = m_service;
+  co_await blocking(scheduler, [=]() { service->move(request, response); });
+}
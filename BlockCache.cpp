@@ -0,0 +1,73 @@
+#include <cstring>
+
+#include "BlockCache.h"
+
+using namespace std;
+
+BlockCache::BlockCache(int blockSize, int capacity) {
+  m_blockSize = blockSize;
+  m_capacity = (capacity > 0) ? capacity : 0;
+  m_frames = new unsigned char[(size_t) m_capacity * m_blockSize];
+  m_frameBlocks.assign(m_capacity, -1);
+  m_referenced.assign(m_capacity, false);
+  m_hand = 0;
+  m_hits = 0;
+  m_misses = 0;
+}
+
+BlockCache::~BlockCache() {
+  delete [] m_frames;
+}
+
+bool BlockCache::lookup(int blockNumber, void *buffer) {
+  unordered_map<int, int>::iterator iter = m_index.find(blockNumber);
+  if (iter == m_index.end()) {
+    m_misses++;
+    return false;
+  }
+
+  int frame = iter->second;
+  m_referenced[frame] = true;
+  memcpy(buffer, m_frames + (size_t) frame * m_blockSize, m_blockSize);
+  m_hits++;
+  return true;
+}
+
+void BlockCache::insert(int blockNumber, const void *buffer) {
+  if (m_capacity == 0) {
+    return;
+  }
+
+  int frame;
+  unordered_map<int, int>::iterator iter = m_index.find(blockNumber);
+  if (iter != m_index.end()) {
+    frame = iter->second;
+  } else {
+    // sweep the hand, giving referenced frames a second chance
+    while (m_frameBlocks[m_hand] != -1 && m_referenced[m_hand]) {
+      m_referenced[m_hand] = false;
+      m_hand = (m_hand + 1) % m_capacity;
+    }
+    frame = m_hand;
+    m_hand = (m_hand + 1) % m_capacity;
+
+    if (m_frameBlocks[frame] != -1) {
+      m_index.erase(m_frameBlocks[frame]);
+    }
+    m_frameBlocks[frame] = blockNumber;
+    m_index[blockNumber] = frame;
+  }
+
+  m_referenced[frame] = true;
+  memcpy(m_frames + (size_t) frame * m_blockSize, buffer, m_blockSize);
+}
+
+void BlockCache::invalidate(int blockNumber) {
+  unordered_map<int, int>::iterator iter = m_index.find(blockNumber);
+  if (iter == m_index.end()) {
+    return;
+  }
+  m_frameBlocks[iter->second] = -1;
+  m_referenced[iter->second] = false;
+  m_index.erase(iter);
+}
@@ -0,0 +1,64 @@
+#include <iostream>
+
+#include "Coroutine.h"
+
+using namespace std;
+
+void resumeCoroutine(void *arg) {
+  coroutine_handle<>::from_address(arg).resume();
+}
+
+coroutine_handle<> Task::FinalAwaiter::await_suspend(coroutine_handle<promise_type> handle) noexcept {
+  promise_type &promise = handle.promise();
+  if (promise.detached) {
+    handle.destroy();
+    return noop_coroutine();
+  }
+  if (promise.continuation) {
+    return promise.continuation;
+  }
+  return noop_coroutine();
+}
+
+void Task::promise_type::unhandled_exception() {
+  if (detached) {
+    // nobody is left to rethrow it to, like a thread that throws
+    cerr << "Uncaught exception in a detached coroutine" << endl;
+    terminate();
+  }
+  exception = current_exception();
+}
+
+coroutine_handle<> Task::Awaiter::await_suspend(coroutine_handle<> awaiting) {
+  handle.promise().continuation = awaiting;
+  return handle;
+}
+
+void Task::Awaiter::await_resume() {
+  if (handle.promise().exception) {
+    rethrow_exception(handle.promise().exception);
+  }
+}
+
+Task::Task(Task &&other) noexcept : m_handle(other.m_handle) {
+  other.m_handle = nullptr;
+}
+
+Task::~Task() {
+  if (m_handle) {
+    m_handle.destroy();
+  }
+}
+
+Task::Awaiter Task::operator co_await() {
+  Awaiter awaiter;
+  awaiter.handle = m_handle;
+  return awaiter;
+}
+
+void Task::detach() {
+  coroutine_handle<promise_type> handle = m_handle;
+  m_handle = nullptr;
+  handle.promise().detached = true;
+  handle.resume();
+}
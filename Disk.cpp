@@ -1,7 +1,11 @@
 #include <iostream>
+#include <cstring>
+#include <vector>
 #include <unistd.h>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 
 #include <sys/types.h>
@@ -11,26 +15,98 @@
 
 #include "Disk.h"
 #include "dthread.h"
+#include "ufs.h"
 
 using namespace std;
 
-Disk::Disk(string imageFile, int blockSize) {
+/*
+ * Journal format
+ *
+ * Images made with `mkfs -j` have a journal region described by
+ * journal_addr and journal_len in the superblock. The first journal block
+ * holds a journal_super_t with the sequence number of the oldest
+ * transaction that still has to be replayed. Transactions follow it back
+ * to back: one descriptor block (a journal_txn_t followed by the home
+ * block numbers) and then the new contents of each of those blocks. The
+ * checksum covers the block numbers and contents, so a transaction that
+ * was only partially written before a crash is recognized and dropped.
+ *
+ * A commit appends its transaction and flushes once. The blocks are
+ * written to their home locations later, when the journal fills up or
+ * the Disk is destroyed, and until then reads are served from memory.
+ */
+#define JOURNAL_MAGIC (0x4c4e524a)
+#define JOURNAL_TXN_MAGIC (0x4e58544a)
+
+typedef struct {
+  unsigned int magic;
+  unsigned int sequence;
+} journal_super_t;
+
+typedef struct {
+  unsigned int magic;
+  unsigned int sequence;
+  unsigned int checksum;
+  int count;
+  // followed by count block numbers
+} journal_txn_t;
+
+static unsigned int journalChecksum(const int *blockNumbers, int count,
+                                    const unsigned char *data, int length) {
+  // FNV-1a
+  unsigned int hash = 2166136261u;
+  const unsigned char *bytes = (const unsigned char *) blockNumbers;
+  for (size_t idx = 0; idx < count * sizeof(int); idx++) {
+    hash = (hash ^ bytes[idx]) * 16777619u;
+  }
+  for (int idx = 0; idx < length; idx++) {
+    hash = (hash ^ data[idx]) * 16777619u;
+  }
+  return hash;
+}
+
+Disk::Disk(string imageFile, int blockSize, bool useMmap) {
   this->imageFile = imageFile;
   this->blockSize = blockSize;
   this->isInTransaction = false;
+  this->rollbackCount = 0;
+  this->isWritable = true;
+  this->journalAddress = 0;
+  this->journalLength = 0;
+  this->journalHead = 1;
+  this->journalSequence = 1;
+  this->durabilityMode = SYNC_ON_COMMIT;
+  this->groupCommitWindow = 0;
+  pthread_mutex_init(&this->transactionLock, NULL);
+  pthread_mutex_init(&this->stateLock, NULL);
+  this->cacheGeneration = 0;
+  this->writingInPlace = false;
+  this->wroteNewBlocks = false;
+  pthread_mutex_init(&this->syncLock, NULL);
+  pthread_cond_init(&this->syncDone, NULL);
+  this->syncRequested = 0;
+  this->syncCompleted = 0;
+  this->syncInProgress = false;
+  this->mappedImage = NULL;
+  this->blockCache = new BlockCache(blockSize, DEFAULT_CACHE_BLOCKS);
+  this->ioRing = NULL;
   
   struct stat stat;
-  int imageFileDescriptor = open(imageFile.c_str(), O_RDONLY);
-  if (imageFileDescriptor < 0) {
+  this->imageFileDescriptor = open(imageFile.c_str(), O_RDWR);
+  if (this->imageFileDescriptor < 0 && (errno == EACCES || errno == EROFS)) {
+    // read-only images are fine for tools that never write
+    this->imageFileDescriptor = open(imageFile.c_str(), O_RDONLY);
+    this->isWritable = false;
+  }
+  if (this->imageFileDescriptor < 0) {
     cerr << "could not open " << imageFile << endl;
     exit(1);
   }
-  int ret = fstat(imageFileDescriptor, &stat);
+  int ret = fstat(this->imageFileDescriptor, &stat);
   if (ret != 0) {
     cerr << "Could not stat image file" << endl;
     exit(1);
   }
-  close(imageFileDescriptor);
   
   this->imageFileSize = stat.st_size;
 
@@ -41,7 +117,89 @@ Disk::Disk(string imageFile, int blockSize) {
     cerr << "  imageSize % blockSize: " << this->imageFileSize % this->blockSize << endl;
     exit(1);
   }
-  
+
+  if (useMmap) {
+    int protection = this->isWritable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void *mapping = mmap(NULL, this->imageFileSize, protection, MAP_SHARED, this->imageFileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+      perror("mmap");
+      cerr << "Could not map image file " << imageFile << endl;
+      exit(1);
+    }
+    this->mappedImage = (unsigned char *) mapping;
+    // the mapping already is a cache of the whole image
+    this->setCacheSize(0);
+  }
+
+  this->openJournal();
+}
+
+Disk::~Disk() {
+  if (this->ownsTransaction()) {
+    this->rollback();
+  }
+  if (this->isWritable && !checkpointBlocks.empty()) {
+    this->checkpoint();
+  }
+  this->releaseBlocks(checkpointBlocks);
+  delete this->blockCache;
+  delete this->ioRing;
+  if (this->mappedImage != NULL) {
+    munmap(this->mappedImage, this->imageFileSize);
+  }
+  if (this->imageFileDescriptor >= 0) {
+    close(this->imageFileDescriptor);
+  }
+  pthread_cond_destroy(&this->syncDone);
+  pthread_mutex_destroy(&this->syncLock);
+  pthread_mutex_destroy(&this->stateLock);
+  pthread_mutex_destroy(&this->transactionLock);
+}
+
+void Disk::setDurabilityMode(DurabilityMode mode) {
+  this->durabilityMode = mode;
+}
+
+void Disk::setGroupCommitWindow(int microseconds) {
+  this->groupCommitWindow = microseconds;
+}
+
+bool Disk::setIoRing(int entries) {
+  delete this->ioRing;
+  this->ioRing = NULL;
+  if (entries <= 0) {
+    return true;
+  }
+  if (this->mappedImage != NULL) {
+    return false;
+  }
+  this->ioRing = IoRing::open(entries);
+  return this->ioRing != NULL;
+}
+
+void Disk::setCacheSize(int blocks) {
+  pthread_mutex_lock(&stateLock);
+  delete this->blockCache;
+  this->blockCache = new BlockCache(blockSize, blocks);
+  pthread_mutex_unlock(&stateLock);
+}
+
+unsigned long Disk::cacheHits() {
+  pthread_mutex_lock(&stateLock);
+  unsigned long hits = this->blockCache->hits();
+  pthread_mutex_unlock(&stateLock);
+  return hits;
+}
+
+unsigned long Disk::cacheMisses() {
+  pthread_mutex_lock(&stateLock);
+  unsigned long misses = this->blockCache->misses();
+  pthread_mutex_unlock(&stateLock);
+  return misses;
+}
+
+unsigned long Disk::rollbacks() {
+  return this->rollbackCount;
 }
 
 int Disk::numberOfBlocks() {
@@ -54,27 +212,150 @@ void Disk::readBlock(int blockNumber, void *buffer) {
     exit(1);
   }
 
-  int fd = open(this->imageFile.c_str(), O_RDONLY);
-  if (fd < 0) {
-    cerr << "Could not open image file " << this->imageFile << endl;
-    exit(1);
+  unsigned long generation;
+  if (this->readBlockFromMemory(blockNumber, buffer, &generation)) {
+    return;
   }
+  this->readImage((off_t) blockNumber * this->blockSize, buffer, this->blockSize);
+  this->cacheBlock(blockNumber, buffer, generation);
+}
 
-  int offset = blockNumber * this->blockSize;
-  int ret = lseek(fd, offset, SEEK_SET);
-  if (ret != offset) {
-    perror("read::lseek");
-    cerr << "Could not seek to file" << endl;
-    exit(1);
+bool Disk::readBlockFromMemory(int blockNumber, void *buffer, unsigned long *generation) {
+  // the newest copy of a block might not be in its home location yet. Only
+  // the transaction's own thread sees what it has not committed
+  if (this->ownsTransaction()) {
+    map<int, unsigned char *>::iterator iter = pendingBlocks.find(blockNumber);
+    if (iter != pendingBlocks.end()) {
+      memcpy(buffer, iter->second, this->blockSize);
+      return true;
+    }
   }
 
-  ret = read(fd, buffer, this->blockSize);
-  if (ret != this->blockSize) {
-    cerr << "Could not read file" << endl;
-    exit(1);
+  pthread_mutex_lock(&stateLock);
+  bool found = true;
+  map<int, unsigned char *>::iterator iter = checkpointBlocks.find(blockNumber);
+  if (iter != checkpointBlocks.end()) {
+    memcpy(buffer, iter->second, this->blockSize);
+  } else {
+    found = blockCache->lookup(blockNumber, buffer);
   }
+  *generation = cacheGeneration;
+  pthread_mutex_unlock(&stateLock);
+  return found;
+}
 
-  close(fd);
+void Disk::cacheBlock(int blockNumber, const void *buffer, unsigned long generation) {
+  pthread_mutex_lock(&stateLock);
+  if (generation == cacheGeneration && !writingInPlace) {
+    blockCache->insert(blockNumber, buffer);
+  }
+  pthread_mutex_unlock(&stateLock);
+}
+
+void Disk::readBlocks(int count, const int *blockNumbers, const struct iovec *buffers) {
+  for (int i = 0; i < count; i++) {
+    if (blockNumbers[i] < 0 || blockNumbers[i] >= this->numberOfBlocks()) {
+      cerr << "Invalid block number " << blockNumbers[i] << endl;
+      exit(1);
+    }
+  }
+
+  // blocks that are only on the image are read in runs of adjacent block
+  // numbers, one preadv each. With an io_uring the runs are collected and
+  // all of them go to the kernel at once
+  bool batch = ioRing != NULL && mappedImage == NULL;
+  vector<ReadRun> runs;
+  int i = 0;
+  while (i < count) {
+    unsigned long generation;
+    if (this->readBlockFromMemory(blockNumbers[i], buffers[i].iov_base, &generation)) {
+      i++;
+      continue;
+    }
+    int runEnd = i + 1;
+    bool endInMemory = false;
+    while (runEnd < count && runEnd - i < IOV_MAX && blockNumbers[runEnd] == blockNumbers[runEnd - 1] + 1) {
+      unsigned long ignored;
+      if (this->readBlockFromMemory(blockNumbers[runEnd], buffers[runEnd].iov_base, &ignored)) {
+        endInMemory = true;
+        break;
+      }
+      runEnd++;
+    }
+
+    if (batch) {
+      ReadRun run = {this, blockNumbers + i, buffers + i, runEnd - i, generation};
+      runs.push_back(run);
+    } else {
+      this->readImageVectored((off_t) blockNumbers[i] * blockSize, buffers + i, runEnd - i);
+      for (int j = i; j < runEnd; j++) {
+        this->cacheBlock(blockNumbers[j], buffers[j].iov_base, generation);
+      }
+    }
+    i = endInMemory ? runEnd + 1 : runEnd;
+  }
+
+  if (runs.empty()) {
+    return;
+  }
+  // runs doesn't grow any more, so the operations can point into it
+  vector<IoRing::Operation> reads(runs.size());
+  for (unsigned int idx = 0; idx < runs.size(); idx++) {
+    IoRing::Operation &read = reads[idx];
+    memset(&read, 0, sizeof(read));
+    read.type = IoRing::READ;
+    read.fd = this->imageFileDescriptor;
+    read.buffers = runs[idx].buffers;
+    read.count = runs[idx].count;
+    read.offset = (off_t) runs[idx].blockNumbers[0] * blockSize;
+    read.callback = cacheReadRun;
+    read.arg = &runs[idx];
+  }
+  this->readImageBatch(reads);
+}
+
+void Disk::cacheReadRun(void *arg, int result) {
+  ReadRun *run = (ReadRun *) arg;
+  if (result != run->count * run->disk->blockSize) {
+    // readImageBatch gives up on it
+    return;
+  }
+  for (int i = 0; i < run->count; i++) {
+    run->disk->cacheBlock(run->blockNumbers[i], run->buffers[i].iov_base, run->generation);
+  }
+}
+
+void Disk::readBlocks(int firstBlock, int count, void *buffer) {
+  vector<int> blockNumbers(count);
+  vector<struct iovec> buffers(count);
+  for (int i = 0; i < count; i++) {
+    blockNumbers[i] = firstBlock + i;
+    buffers[i].iov_base = static_cast<unsigned char *>(buffer) + (size_t) i * blockSize;
+    buffers[i].iov_len = blockSize;
+  }
+  this->readBlocks(count, blockNumbers.data(), buffers.data());
+}
+
+const unsigned char *Disk::peekBlock(int blockNumber) {
+  if (mappedImage == NULL || blockNumber < 0 || blockNumber >= this->numberOfBlocks()) {
+    return NULL;
+  }
+
+  if (this->ownsTransaction()) {
+    map<int, unsigned char *>::iterator iter = pendingBlocks.find(blockNumber);
+    if (iter != pendingBlocks.end()) {
+      return iter->second;
+    }
+  }
+  // a checkpoint on another thread may free the journal's copy at any
+  // time, so those blocks have to be copied with readBlock
+  pthread_mutex_lock(&stateLock);
+  bool journaled = checkpointBlocks.find(blockNumber) != checkpointBlocks.end();
+  pthread_mutex_unlock(&stateLock);
+  if (journaled) {
+    return NULL;
+  }
+  return mappedImage + (size_t) blockNumber * this->blockSize;
 }
 
 void Disk::writeBlock(int blockNumber, void *buffer) {  
@@ -83,60 +364,572 @@ void Disk::writeBlock(int blockNumber, void *buffer) {
     exit(1);
   }
 
-  if (isInTransaction) {
-    struct UndoRecord undoRecord;
-    undoRecord.blockNumber = blockNumber;
-    undoRecord.blockData = new unsigned char[blockSize];
-    this->readBlock(blockNumber, undoRecord.blockData);
-    undoLog.push_front(undoRecord);
+  if (!this->ownsTransaction()) {
+    this->beginTransaction();
+    this->writeBlock(blockNumber, buffer);
+    this->commit();
+    return;
   }
-  
-  int fd = open(this->imageFile.c_str(), O_RDWR);
-  if (fd < 0) {
-    cerr << "Could not open image file " << this->imageFile << endl;
+
+  // redo logging: remember the new contents, nothing touches the image
+  // until commit
+  unsigned char *&blockData = pendingBlocks[blockNumber];
+  if (blockData == NULL) {
+    blockData = new unsigned char[blockSize];
+  }
+  memcpy(blockData, buffer, blockSize);
+}
+
+void Disk::writeBlocks(int count, const int *blockNumbers, const struct iovec *buffers) {
+  // all of them are one transaction when there is no open one. Nothing
+  // reaches the image before commit, which writes adjacent blocks together
+  bool ownTransaction = !this->ownsTransaction();
+  if (ownTransaction) {
+    this->beginTransaction();
+  }
+  for (int i = 0; i < count; i++) {
+    this->writeBlock(blockNumbers[i], buffers[i].iov_base);
+  }
+  if (ownTransaction) {
+    this->commit();
+  }
+}
+
+void Disk::writeNewBlocks(int count, const int *blockNumbers, const struct iovec *buffers) {
+  if (!this->ownsTransaction()) {
+    this->writeBlocks(count, blockNumbers, buffers);
+    return;
+  }
+
+  // only the transaction owner changes checkpointBlocks
+  map<int, unsigned char *> blocks;
+  for (int i = 0; i < count; i++) {
+    if (blockNumbers[i] < 0 || blockNumbers[i] >= this->numberOfBlocks()) {
+      cerr << "Invalid block number " << blockNumbers[i] << endl;
+      exit(1);
+    }
+    if (checkpointBlocks.find(blockNumbers[i]) != checkpointBlocks.end()) {
+      this->writeBlock(blockNumbers[i], buffers[i].iov_base);
+      continue;
+    }
+    blocks[blockNumbers[i]] = (unsigned char *) buffers[i].iov_base;
+    // this supersedes an earlier write by the transaction
+    map<int, unsigned char *>::iterator pending = pendingBlocks.find(blockNumbers[i]);
+    if (pending != pendingBlocks.end()) {
+      delete [] pending->second;
+      pendingBlocks.erase(pending);
+    }
+  }
+  if (blocks.empty()) {
+    return;
+  }
+  this->writeBlocksToImage(blocks, false);
+  wroteNewBlocks = true;
+
+  // the cache may have what the blocks held before they were freed, and
+  // a read that raced the write may be about to cache it
+  pthread_mutex_lock(&stateLock);
+  map<int, unsigned char *>::iterator iter;
+  for (iter = blocks.begin(); iter != blocks.end(); iter++) {
+    blockCache->invalidate(iter->first);
+  }
+  cacheGeneration++;
+  pthread_mutex_unlock(&stateLock);
+}
+
+void Disk::writeBlocks(int firstBlock, int count, const void *buffer) {
+  vector<int> blockNumbers(count);
+  vector<struct iovec> buffers(count);
+  for (int i = 0; i < count; i++) {
+    blockNumbers[i] = firstBlock + i;
+    buffers[i].iov_base = (unsigned char *) buffer + (size_t) i * blockSize;
+    buffers[i].iov_len = blockSize;
+  }
+  this->writeBlocks(count, blockNumbers.data(), buffers.data());
+}
+
+void Disk::writeBlockToImage(int blockNumber, void *buffer) {
+  this->writeImage((off_t) blockNumber * this->blockSize, buffer, this->blockSize);
+}
+
+void Disk::writeBlocksToImage(map<int, unsigned char *> &blocks, bool sync) {
+  // the map is sorted by block number, so runs of adjacent blocks go out
+  // with a single pwritev each
+  map<int, unsigned char *>::iterator iter = blocks.begin();
+  if (ioRing != NULL && mappedImage == NULL) {
+    // or with one operation each, all submitted together
+    vector<struct iovec> iov(blocks.size());
+    vector<IoRing::Operation> writes;
+    int iovcnt = 0;
+    while (iter != blocks.end()) {
+      IoRing::Operation write;
+      memset(&write, 0, sizeof(write));
+      write.type = IoRing::WRITE;
+      write.fd = this->imageFileDescriptor;
+      write.buffers = &iov[iovcnt];
+      write.offset = (off_t) iter->first * blockSize;
+      int runStart = iter->first;
+      while (iter != blocks.end() && iter->first == runStart + write.count && write.count < IOV_MAX) {
+        iov[iovcnt].iov_base = iter->second;
+        iov[iovcnt].iov_len = blockSize;
+        iovcnt++;
+        write.count++;
+        iter++;
+      }
+      writes.push_back(write);
+    }
+    this->writeImageBatch(writes, sync);
+    return;
+  }
+
+  while (iter != blocks.end()) {
+    int runStart = iter->first;
+    struct iovec iov[IOV_MAX];
+    int iovcnt = 0;
+    while (iter != blocks.end() && iter->first == runStart + iovcnt && iovcnt < IOV_MAX) {
+      iov[iovcnt].iov_base = iter->second;
+      iov[iovcnt].iov_len = blockSize;
+      iovcnt++;
+      iter++;
+    }
+
+    if (iovcnt == 1 || mappedImage != NULL) {
+      for (int i = 0; i < iovcnt; i++) {
+        this->writeBlockToImage(runStart + i, iov[i].iov_base);
+      }
+      continue;
+    }
+
+    if (!this->isWritable) {
+      cerr << "Could not open image file " << this->imageFile << " for writing" << endl;
+      exit(1);
+    }
+    ssize_t ret = pwritev(this->imageFileDescriptor, iov, iovcnt, (off_t) runStart * blockSize);
+    if (ret < 0 || ret != (ssize_t) iovcnt * blockSize) {
+      perror("write::pwritev");
+      cerr << "Could not write file" << endl;
+      exit(1);
+    }
+  }
+  if (sync) {
+    this->syncImage();
+  }
+}
+
+void Disk::readImageBatch(vector<IoRing::Operation> &reads) {
+  ioRing->run(reads.data(), reads.size());
+  for (unsigned int idx = 0; idx < reads.size(); idx++) {
+    if (reads[idx].result != reads[idx].count * blockSize) {
+      errno = reads[idx].result < 0 ? -reads[idx].result : EIO;
+      perror("read::io_uring");
+      cerr << "Could not read file" << endl;
+      exit(1);
+    }
+  }
+}
+
+void Disk::writeImageBatch(vector<IoRing::Operation> &writes, bool sync) {
+  if (!this->isWritable) {
+    cerr << "Could not open image file " << this->imageFile << " for writing" << endl;
     exit(1);
   }
 
-  int offset = blockNumber * this->blockSize;
-  int ret = lseek(fd, offset, SEEK_SET);
-  if (ret != offset) {
-    perror("write::lseek");
-    cerr << "Could not seek to file" << endl;
+  // the flush is linked behind the writes so that the kernel starts it
+  // once they are done, without another round trip. A group commit window
+  // needs the flush shared between committers, so it goes through syncImage
+  int count = writes.size();
+  bool linkedSync = sync && groupCommitWindow == 0;
+  if (linkedSync) {
+    for (int idx = 0; idx < count; idx++) {
+      writes[idx].link = true;
+    }
+    IoRing::Operation flush;
+    memset(&flush, 0, sizeof(flush));
+    flush.type = IoRing::DATA_SYNC;
+    flush.fd = this->imageFileDescriptor;
+    writes.push_back(flush);
+  }
+  ioRing->run(writes.data(), writes.size());
+
+  for (int idx = 0; idx < count; idx++) {
+    ssize_t length = 0;
+    for (int buffer = 0; buffer < writes[idx].count; buffer++) {
+      length += writes[idx].buffers[buffer].iov_len;
+    }
+    if (writes[idx].result != length) {
+      errno = writes[idx].result < 0 ? -writes[idx].result : EIO;
+      perror("write::io_uring");
+      cerr << "Could not write file" << endl;
+      exit(1);
+    }
+  }
+  if (linkedSync && writes[count].result != 0) {
+    errno = -writes[count].result;
+    perror("sync");
+    cerr << "Could not sync image file" << endl;
     exit(1);
   }
+  if (sync && !linkedSync) {
+    this->syncImage();
+  }
+}
+
+void Disk::readImage(off_t offset, void *buffer, size_t length) {
+  if (mappedImage != NULL) {
+    memcpy(buffer, mappedImage + offset, length);
+    return;
+  }
 
-  ret = write(fd, buffer, this->blockSize);
-  if (ret != this->blockSize) {
+  ssize_t ret = pread(this->imageFileDescriptor, buffer, length, offset);
+  if (ret < 0 || (size_t) ret != length) {
+    perror("read::pread");
+    cerr << "Could not read file" << endl;
+    exit(1);
+  }
+}
+
+void Disk::readImageVectored(off_t offset, const struct iovec *buffers, int count) {
+  if (count == 1 || mappedImage != NULL) {
+    for (int i = 0; i < count; i++) {
+      this->readImage(offset + (off_t) i * blockSize, buffers[i].iov_base, buffers[i].iov_len);
+    }
+    return;
+  }
+
+  ssize_t ret = preadv(this->imageFileDescriptor, buffers, count, offset);
+  if (ret < 0 || ret != (ssize_t) count * blockSize) {
+    perror("read::preadv");
+    cerr << "Could not read file" << endl;
+    exit(1);
+  }
+}
+
+void Disk::writeImage(off_t offset, const void *buffer, size_t length) {
+  if (!this->isWritable) {
+    cerr << "Could not open image file " << this->imageFile << " for writing" << endl;
+    exit(1);
+  }
+
+  if (mappedImage != NULL) {
+    memcpy(mappedImage + offset, buffer, length);
+    return;
+  }
+
+  ssize_t ret = pwrite(this->imageFileDescriptor, buffer, length, offset);
+  if (ret < 0 || (size_t) ret != length) {
+    perror("write::pwrite");
     cerr << "Could not write file" << endl;
     exit(1);
   }
-  fsync(fd);
-  close(fd);
+}
+
+void Disk::syncImage() {
+  pthread_mutex_lock(&syncLock);
+  unsigned long ticket = ++syncRequested;
+  while (syncCompleted < ticket) {
+    if (syncInProgress) {
+      // somebody else is flushing, they might cover us
+      pthread_cond_wait(&syncDone, &syncLock);
+      continue;
+    }
+
+    // become the leader and flush for everyone who is waiting
+    syncInProgress = true;
+    pthread_mutex_unlock(&syncLock);
+    if (groupCommitWindow > 0) {
+      usleep(groupCommitWindow);
+    }
+    pthread_mutex_lock(&syncLock);
+    // every ticket up to here was taken after its blocks were written
+    unsigned long covered = syncRequested;
+    pthread_mutex_unlock(&syncLock);
+
+    int ret;
+    if (mappedImage != NULL) {
+      ret = msync(mappedImage, this->imageFileSize, MS_SYNC);
+    } else {
+      ret = fdatasync(this->imageFileDescriptor);
+    }
+    if (ret != 0) {
+      perror("sync");
+      cerr << "Could not sync image file" << endl;
+      exit(1);
+    }
+
+    pthread_mutex_lock(&syncLock);
+    syncCompleted = covered;
+    syncInProgress = false;
+    pthread_cond_broadcast(&syncDone);
+  }
+  pthread_mutex_unlock(&syncLock);
+}
+
+bool Disk::ownsTransaction() {
+  return isInTransaction && pthread_equal(transactionOwner, pthread_self());
+}
+
+bool Disk::inTransaction() {
+  return this->ownsTransaction();
 }
 
 void Disk::beginTransaction() {
-  if (isInTransaction) {
+  if (this->ownsTransaction()) {
     cerr << "You can't start a new transaction: one already exists" << endl;
     exit(1);
   }
+  pthread_mutex_lock(&transactionLock);
+  transactionOwner = pthread_self();
   isInTransaction = true;
 }
 
-void Disk::commit() {
+void Disk::commit(PublishCallback callback, void *arg) {
+  if (!this->ownsTransaction()) {
+    return;
+  }
+  if (!pendingBlocks.empty()) {
+    this->commitPendingBlocks(callback, arg);
+  } else if (callback != NULL) {
+    callback(arg, true);
+    callback(arg, false);
+  }
+  wroteNewBlocks = false;
   isInTransaction = false;
-  deque<struct UndoRecord>::iterator iter;
-  for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
-    delete [] iter->blockData;
+  pthread_mutex_unlock(&transactionLock);
+}
+
+void Disk::commitPendingBlocks(PublishCallback callback, void *arg) {
+  map<int, unsigned char *>::iterator iter;
+  // the blocks writeNewBlocks wrote have to be durable before anything
+  // that points to them is
+  if (wroteNewBlocks) {
+    this->syncImage();
+  }
+  if (durabilityMode == SYNC_ON_COMMIT && this->appendToJournal()) {
+    // the new contents are what readers see from now on, and the journal
+    // owns them until they go home at checkpoint
+    if (callback != NULL) {
+      callback(arg, true);
+    }
+    pthread_mutex_lock(&stateLock);
+    for (iter = pendingBlocks.begin(); iter != pendingBlocks.end(); iter++) {
+      blockCache->insert(iter->first, iter->second);
+      unsigned char *&blockData = checkpointBlocks[iter->first];
+      delete [] blockData;
+      blockData = iter->second;
+    }
+    cacheGeneration++;
+    pthread_mutex_unlock(&stateLock);
+    pendingBlocks.clear();
+    if (callback != NULL) {
+      callback(arg, false);
+    }
+    return;
+  }
+
+  // readers may find the blocks on the image as soon as they are written
+  if (callback != NULL) {
+    callback(arg, true);
+  }
+  pthread_mutex_lock(&stateLock);
+  writingInPlace = true;
+  pthread_mutex_unlock(&stateLock);
+
+  // write in place. Older journaled copies of these blocks must not be
+  // replayed over them after a crash, so empty the journal first
+  if (!checkpointBlocks.empty()) {
+    this->checkpoint();
+  }
+  this->writeBlocksToImage(pendingBlocks, true);
+
+  // the cache only gets the new contents once they are on the image, and
+  // whatever was read from the image meanwhile might predate them
+  pthread_mutex_lock(&stateLock);
+  for (iter = pendingBlocks.begin(); iter != pendingBlocks.end(); iter++) {
+    blockCache->insert(iter->first, iter->second);
+  }
+  cacheGeneration++;
+  writingInPlace = false;
+  pthread_mutex_unlock(&stateLock);
+  this->releaseBlocks(pendingBlocks);
+  if (callback != NULL) {
+    callback(arg, false);
   }
-  undoLog.clear();
 }
 
 void Disk::rollback() {
+  if (!this->ownsTransaction()) {
+    return;
+  }
+  rollbackCount++;
+  this->releaseBlocks(pendingBlocks);
+  wroteNewBlocks = false;
   isInTransaction = false;
-  deque<struct UndoRecord>::iterator iter;
-  for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
-    this->writeBlock(iter->blockNumber, iter->blockData);
-    delete [] iter->blockData;
+  pthread_mutex_unlock(&transactionLock);
+}
+
+void Disk::releaseBlocks(map<int, unsigned char *> &blocks) {
+  map<int, unsigned char *>::iterator iter;
+  for (iter = blocks.begin(); iter != blocks.end(); iter++) {
+    delete [] iter->second;
+  }
+  blocks.clear();
+}
+
+void Disk::openJournal() {
+  unsigned char block[blockSize];
+  super_t super;
+  this->readBlock(0, block);
+  memcpy(&super, block, sizeof(super_t));
+
+  if (super.journal_len == 0) {
+    return;
+  }
+  if (super.journal_addr <= 0 || super.journal_len < 2 ||
+      super.journal_addr + super.journal_len > this->numberOfBlocks()) {
+    cerr << "Invalid journal region " << super.journal_addr << " [" << super.journal_len << "]" << endl;
+    exit(1);
+  }
+  journalAddress = super.journal_addr;
+  journalLength = super.journal_len;
+
+  this->recoverJournal();
+}
+
+void Disk::recoverJournal() {
+  unsigned char block[blockSize];
+  journal_super_t journalSuper;
+  this->readBlock(journalAddress, block);
+  memcpy(&journalSuper, block, sizeof(journal_super_t));
+
+  if (journalSuper.magic != JOURNAL_MAGIC) {
+    // a fresh journal from mkfs, claim it before anything is appended
+    journalSequence = 1;
+    journalHead = 1;
+    if (isWritable) {
+      this->writeJournalSuper();
+      this->syncImage();
+    }
+    return;
+  }
+
+  // collect every complete transaction, in order, newest contents win
+  journalSequence = journalSuper.sequence;
+  journalHead = 1;
+  int maxCount = (blockSize - sizeof(journal_txn_t)) / sizeof(int);
+  while (journalHead < journalLength) {
+    this->readBlock(journalAddress + journalHead, block);
+    journal_txn_t txn;
+    memcpy(&txn, block, sizeof(journal_txn_t));
+    if (txn.magic != JOURNAL_TXN_MAGIC || txn.sequence != journalSequence ||
+        txn.count <= 0 || txn.count > maxCount ||
+        journalHead + 1 + txn.count > journalLength) {
+      break;
+    }
+
+    int blockNumbers[txn.count];
+    memcpy(blockNumbers, block + sizeof(journal_txn_t), txn.count * sizeof(int));
+    unsigned char *data = new unsigned char[txn.count * blockSize];
+    this->readImage((off_t) (journalAddress + journalHead + 1) * blockSize, data, txn.count * blockSize);
+    bool valid =
+      journalChecksum(blockNumbers, txn.count, data, txn.count * blockSize) == txn.checksum;
+    for (int idx = 0; valid && idx < txn.count; idx++) {
+      valid = blockNumbers[idx] >= 0 && blockNumbers[idx] < this->numberOfBlocks();
+    }
+    if (!valid) {
+      // torn write, this transaction never committed
+      delete [] data;
+      break;
+    }
+
+    for (int idx = 0; idx < txn.count; idx++) {
+      unsigned char *&blockData = checkpointBlocks[blockNumbers[idx]];
+      if (blockData == NULL) {
+        blockData = new unsigned char[blockSize];
+      }
+      memcpy(blockData, data + idx * blockSize, blockSize);
+    }
+    delete [] data;
+    journalHead += 1 + txn.count;
+    journalSequence++;
+  }
+
+  // replay. A read-only image keeps serving the replayed blocks from memory
+  if (isWritable && !checkpointBlocks.empty()) {
+    this->checkpoint();
+  }
+}
+
+bool Disk::appendToJournal() {
+  int count = pendingBlocks.size();
+  int maxCount = (blockSize - sizeof(journal_txn_t)) / sizeof(int);
+  if (journalLength == 0 || count > maxCount || 1 + count > journalLength - 1) {
+    return false;
+  }
+  if (journalHead + 1 + count > journalLength) {
+    this->checkpoint();
+  }
+
+  // the descriptor and the block contents go out in one sequential write
+  unsigned char *record = new unsigned char[(1 + count) * blockSize];
+  memset(record, 0, blockSize);
+  int *blockNumbers = (int *) (record + sizeof(journal_txn_t));
+  int idx = 0;
+  map<int, unsigned char *>::iterator iter;
+  for (iter = pendingBlocks.begin(); iter != pendingBlocks.end(); iter++, idx++) {
+    blockNumbers[idx] = iter->first;
+    memcpy(record + (1 + idx) * blockSize, iter->second, blockSize);
+  }
+  journal_txn_t txn;
+  txn.magic = JOURNAL_TXN_MAGIC;
+  txn.sequence = journalSequence;
+  txn.count = count;
+  txn.checksum = journalChecksum(blockNumbers, count, record + blockSize, count * blockSize);
+  memcpy(record, &txn, sizeof(journal_txn_t));
+
+  if (ioRing != NULL && mappedImage == NULL) {
+    struct iovec iov = {record, (size_t) (1 + count) * blockSize};
+    vector<IoRing::Operation> writes(1);
+    memset(&writes[0], 0, sizeof(IoRing::Operation));
+    writes[0].type = IoRing::WRITE;
+    writes[0].fd = this->imageFileDescriptor;
+    writes[0].buffers = &iov;
+    writes[0].count = 1;
+    writes[0].offset = (off_t) (journalAddress + journalHead) * blockSize;
+    this->writeImageBatch(writes, true);
+  } else {
+    this->writeImage((off_t) (journalAddress + journalHead) * blockSize, record, (1 + count) * blockSize);
+    this->syncImage();
+  }
+  delete [] record;
+
+  journalHead += 1 + count;
+  journalSequence++;
+  return true;
+}
+
+void Disk::writeJournalSuper() {
+  unsigned char block[blockSize];
+  memset(block, 0, blockSize);
+  journal_super_t journalSuper;
+  journalSuper.magic = JOURNAL_MAGIC;
+  journalSuper.sequence = journalSequence;
+  memcpy(block, &journalSuper, sizeof(journal_super_t));
+  this->writeBlockToImage(journalAddress, block);
+}
+
+void Disk::checkpoint() {
+  // only the transaction owner changes checkpointBlocks, so it can be
+  // written out without the lock. Readers find the blocks in the image
+  // once they are released
+  this->writeBlocksToImage(checkpointBlocks, true);
+  pthread_mutex_lock(&stateLock);
+  this->releaseBlocks(checkpointBlocks);
+  pthread_mutex_unlock(&stateLock);
+
+  // everything before journalSequence is home now, start over
+  if (journalLength > 0) {
+    journalHead = 1;
+    this->writeJournalSuper();
+    this->syncImage();
   }
-  undoLog.clear();
 }
@@ -2,6 +2,8 @@
 #include <iostream>
 #include <algorithm>
 #include <iterator>
+#include <climits>
+#include <cstdio>
 #include "DistributedFileSystemService.h"
 #include "ClientError.h"
 #include "ufs.h"
@@ -9,13 +11,26 @@
 
 using namespace std;
 
+// how much of an upload is held in memory at a time, a longer one is
+// spooled to a temporary file until the transaction that writes it
+#define UPLOAD_CHUNK_SIZE (16 * UFS_BLOCK_SIZE)
+
+// what receiveBody returns for a body longer than the file can take
+#define BODY_TOO_LARGE (-3)
+
 // constructor for DistributedFileSystemService, initializing with a drive file
-DistributedFileSystemService::DistributedFileSystemService(std::string driveFile) : HttpService("/ds3") {
+DistributedFileSystemService::DistributedFileSystemService(std::string driveFile)
+    : HttpService("/ds3"), HttpServiceAdapter(this) {
     // create a new disk object using the provided drive file and block size
     Disk *diskObj = new Disk(driveFile, UFS_BLOCK_SIZE);
     fileSystem = new LocalFileSystem(diskObj);  // Set up the local file system with the disk
 }
 
+DistributedFileSystemService::DistributedFileSystemService(LocalFileSystem *fileSystem)
+    : HttpService("/ds3"), HttpServiceAdapter(this) {
+    this->fileSystem = fileSystem;
+}
+
 // function to split a given path into its parent directory and target file/directory name
 std::pair<std::string, std::string> splitPath(const std::string &path) {
     size_t lastSlashPos = path.find_last_of('/');
@@ -52,6 +67,137 @@ int resolveParentInode(LocalFileSystem *fileSystem, const std::string &parentPat
     return currentInode;
 }
 
+// parse a single byte range, "bytes=first-last", "bytes=first-" or
+// "bytes=-suffix", against a file of fileSize bytes. Returns false when
+// the header is not one range we understand, in which case it is ignored
+// and the whole file is sent. satisfiable says whether the range overlaps
+// the file at all
+static bool parseRange(const std::string &header, int fileSize, int &first, int &last, bool &satisfiable) {
+    const std::string unit = "bytes=";
+    if (header.compare(0, unit.size(), unit) != 0) {
+        return false;
+    }
+    std::string spec = header.substr(unit.size());
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos || spec.find(',') != std::string::npos) {
+        return false;
+    }
+    std::string firstText = spec.substr(0, dash);
+    std::string lastText = spec.substr(dash + 1);
+    if ((firstText.empty() && lastText.empty()) ||
+        firstText.find_first_not_of("0123456789") != std::string::npos ||
+        lastText.find_first_not_of("0123456789") != std::string::npos ||
+        firstText.size() > 10 || lastText.size() > 10) {
+        return false;
+    }
+
+    if (firstText.empty()) {
+        // the last `suffix` bytes
+        long long suffix = std::stoll(lastText);
+        satisfiable = (suffix > 0 && fileSize > 0);
+        first = (int) std::max(0LL, fileSize - suffix);
+        last = fileSize - 1;
+        return true;
+    }
+    long long firstByte = std::stoll(firstText);
+    long long lastByte = lastText.empty() ? LLONG_MAX : std::stoll(lastText);
+    if (lastByte < firstByte) {
+        return false;
+    }
+    satisfiable = (firstByte < fileSize);
+    first = (int) std::min(firstByte, (long long) fileSize);
+    last = (int) std::min(lastByte, (long long) fileSize - 1);
+    return true;
+}
+
+// parse "bytes first-last/total" or "bytes first-last/*" from a PUT
+static bool parseContentRange(const std::string &header, int &first, int &last) {
+    const std::string unit = "bytes ";
+    if (header.compare(0, unit.size(), unit) != 0) {
+        return false;
+    }
+    std::string spec = header.substr(unit.size(), header.find('/') - unit.size());
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos || dash == 0 || dash + 1 == spec.size() ||
+        spec.find_first_not_of("0123456789-") != std::string::npos ||
+        dash > 10 || spec.size() - dash - 1 > 10) {
+        return false;
+    }
+    long long firstByte = std::stoll(spec.substr(0, dash));
+    long long lastByte = std::stoll(spec.substr(dash + 1));
+    if (lastByte < firstByte || lastByte > INT_MAX) {
+        return false;
+    }
+    first = (int) firstByte;
+    last = (int) lastByte;
+    return true;
+}
+
+// the byte range of a file that a GET asks for, all of it without a Range
+// header. Returns false after filling in a 416 if it is not satisfiable
+static bool requestedRange(HTTPRequest *request, HTTPResponse *response, int fileSize,
+                           int &first, int &last, bool &partial) {
+    first = 0;
+    last = fileSize - 1;
+    partial = false;
+    std::string rangeHeader;
+    bool satisfiable = true;
+    if (request->findHeader("Range", rangeHeader) &&
+        parseRange(rangeHeader, fileSize, first, last, satisfiable)) {
+        if (!satisfiable) {
+            response->setStatus(416);
+            response->setHeader("Content-Range", "bytes */" + std::to_string(fileSize));
+            response->setBody("Requested range not satisfiable.");
+            return false;
+        }
+        partial = true;
+    }
+    return true;
+}
+
+// the status and headers for bytesRead bytes of a file read from first.
+// Returns false after filling in a 500 if the read failed
+static bool setReadStatus(HTTPResponse *response, int fileSize, int first, int bytesRead, bool partial) {
+    response->setHeader("Accept-Ranges", "bytes");
+    if (bytesRead < 0) {
+        response->setStatus(500);
+        response->setBody("Failed to read file.");
+        return false;
+    }
+    if (partial) {
+        response->setStatus(206);
+        response->setHeader("Content-Range", "bytes " + std::to_string(first) + "-" +
+                            std::to_string(first + bytesRead - 1) + "/" + std::to_string(fileSize));
+    } else {
+        response->setStatus(200);
+    }
+    return true;
+}
+
+// the size of the file or directory a GET reads, found with lookups that
+// usually hit the dentry cache and one stat. Writes cost their body
+long DistributedFileSystemService::requestSize(HTTPRequest *request) {
+    if (!request->isGet() && !request->isHead()) {
+        return std::max(request->getContentLength(), 0L);
+    }
+    return fileSize(request->getPath());
+}
+
+// the size of whatever is at requestedPath, 0 if there is nothing. Outside
+// any transaction, so only a hint by the time the caller uses it
+int DistributedFileSystemService::fileSize(const std::string &requestedPath) {
+    std::pair<std::string, std::string> pathParts = splitPath(requestedPath);
+    int inodeId = resolveParentInode(fileSystem, pathParts.first);
+    if (inodeId >= 0 && !pathParts.second.empty()) {
+        inodeId = fileSystem->lookup(inodeId, pathParts.second);
+    }
+    inode_t inode;
+    if (inodeId < 0 || fileSystem->stat(inodeId, &inode) != 0) {
+        return 0;
+    }
+    return inode.size;
+}
+
 // handle GET requests: retrieve file/directory information
 void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *response) {
     std::string requestedPath = request->getPath();
@@ -97,9 +243,11 @@ void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *respo
             return;
         }
         
+        // the directory may have shrunk since the stat, only what read
+        // returned is current
         dir_ent_t *directoryEntries = reinterpret_cast<dir_ent_t *>(directoryBuffer.data());
         std::vector<std::string> directoryContents;
-        for (size_t i = 0; i < parentInode.size / sizeof(dir_ent_t); i++) {
+        for (size_t i = 0; i < bytesRead / sizeof(dir_ent_t); i++) {
             // process valid directory entries
             if (directoryEntries[i].inum != -1 && directoryEntries[i].name[0] != '\0' &&
                 std::string(directoryEntries[i].name) != "." && std::string(directoryEntries[i].name) != "..") {
@@ -150,7 +298,7 @@ void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *respo
         
         dir_ent_t *directoryEntries = reinterpret_cast<dir_ent_t *>(directoryBuffer.data());
         std::vector<std::string> directoryContents;
-        for (size_t i = 0; i < fileInode.size / sizeof(dir_ent_t); i++) {
+        for (size_t i = 0; i < bytesRead / sizeof(dir_ent_t); i++) {
             // process valid directory entries
             if (directoryEntries[i].inum != -1 && directoryEntries[i].name[0] != '\0' &&
                 std::string(directoryEntries[i].name) != "." && std::string(directoryEntries[i].name) != "..") {
@@ -172,15 +320,19 @@ void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *respo
         response->setStatus(200);
         response->setBody(responseBody);
     } else if (fileInode.type == UFS_REGULAR_FILE) {
-        // handle regular file reading
-        char fileBuffer[UFS_BLOCK_SIZE];
-        int bytesRead = fileSystem->read(fileInodeId, fileBuffer, sizeof(fileBuffer));
-        if (bytesRead < 0) {
-            response->setStatus(500);
-            response->setBody("Failed to read file.");
-        } else {
-            response->setStatus(200);
-            response->setBody(std::string(fileBuffer, bytesRead));
+        // handle regular file reading, the whole file unless the client
+        // asked for one byte range of it
+        int first, last;
+        bool partial;
+        if (!requestedRange(request, response, fileInode.size, first, last, partial)) {
+            return;
+        }
+
+        int length = last - first + 1;
+        std::vector<char> fileBuffer(std::max(length, 0));
+        int bytesRead = fileSystem->read(fileInodeId, fileBuffer.data(), length, first);
+        if (setReadStatus(response, fileInode.size, first, bytesRead, partial)) {
+            response->setBody(std::string(fileBuffer.data(), bytesRead));
         }
     } else {
         response->setStatus(500);
@@ -188,16 +340,59 @@ void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *respo
     }
 }
 
-// handle PUT requests: upload a file or create a directory
-void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *response) {
+// GET as a coroutine, for gunrock_web -a. A file is read on a blocking
+// thread and written to the client straight from the buffer it was read
+// into, without holding a thread while the client takes it in. Everything
+// else, listings and errors, is small and left to the blocking get()
+Task DistributedFileSystemService::get(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                                       ResponseWriter *writer) {
     std::string requestedPath = request->getPath();
-    std::string fileContent = request->getBody();
-    
+    std::pair<std::string, std::string> pathParts = splitPath(requestedPath);
+    int fileInodeId = -1;
+    inode_t fileInode;
+    if (!pathParts.second.empty()) {
+        co_await blocking(scheduler, [&]() {
+            fileInodeId = resolveParentInode(fileSystem, pathParts.first);
+            if (fileInodeId >= 0) {
+                fileInodeId = fileSystem->lookup(fileInodeId, pathParts.second);
+            }
+            if (fileInodeId >= 0 && fileSystem->stat(fileInodeId, &fileInode) < 0) {
+                fileInodeId = -1;
+            }
+        });
+    }
+    if (fileInodeId < 0 || fileInode.type != UFS_REGULAR_FILE) {
+        co_await HttpServiceAdapter::get(scheduler, request, response, writer);
+        co_return;
+    }
+
+    int first, last;
+    bool partial;
+    if (!requestedRange(request, response, fileInode.size, first, last, partial)) {
+        co_return;
+    }
+    int length = last - first + 1;
+    std::vector<char> fileBuffer(std::max(length, 0));
+    int bytesRead;
+    co_await blocking(scheduler, [&]() {
+        bytesRead = fileSystem->read(fileInodeId, fileBuffer.data(), length, first);
+    });
+    if (!setReadStatus(response, fileInode.size, first, bytesRead, partial)) {
+        co_return;
+    }
+    co_await writer->writeHead(response, bytesRead);
+    co_await writer->writeBody(fileBuffer.data(), bytesRead);
+}
+
+// resolve the file a PUT or POST writes to, creating it and any missing
+// parent directories. Runs inside the caller's transaction. On failure the
+// transaction is rolled back, the response is filled in and -1 returned
+int DistributedFileSystemService::createFile(const std::string &requestedPath, HTTPResponse *response) {
     // split the requested path into parent directory and file name
     std::pair<std::string, std::string> pathParts = splitPath(requestedPath);
     std::string parentDirectoryPath = pathParts.first;
     std::string fileName = pathParts.second;
-    
+
     // resolve or create the parent directories
     int parentInodeId = resolveParentInode(fileSystem, parentDirectoryPath);
     if (parentInodeId < 0) {
@@ -212,9 +407,10 @@ void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *respo
             if (nextInodeId < 0) {
                 nextInodeId = fileSystem->create(parentInodeId, UFS_DIRECTORY, part);
                 if (nextInodeId < 0) {
+                    fileSystem->rollback();
                     response->setStatus(500);
                     response->setBody("Failed to create parent directory: " + part);
-                    return;
+                    return -1;
                 }
             }
             parentInodeId = nextInodeId;
@@ -224,31 +420,218 @@ void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *respo
             if (nextInodeId < 0) {
                 nextInodeId = fileSystem->create(parentInodeId, UFS_DIRECTORY, remainingPath);
                 if (nextInodeId < 0) {
+                    fileSystem->rollback();
                     response->setStatus(500);
                     response->setBody("Failed to create parent directory: " + remainingPath);
-                    return;
+                    return -1;
                 }
             }
             parentInodeId = nextInodeId;
         }
     }
-    
-    // create or update the file
+
+    // create the file, or find the one that is there
     int fileInodeId = fileSystem->create(parentInodeId, UFS_REGULAR_FILE, fileName);
     if (fileInodeId < 0) {
+        fileSystem->rollback();
         response->setStatus(500);
         response->setBody("Failed to create file.");
-        return;
+        return -1;
     }
-    
-    // write the content into the file
-    int bytesWritten = fileSystem->write(fileInodeId, fileContent.data(), fileContent.size());
-    if (bytesWritten < 0) {
+    return fileInodeId;
+}
+
+// read the request body into buffer until it is full or the body ends.
+// Returns how much it read, -1 if the client went away
+static int readBodyChunk(HTTPRequest *request, char *buffer, int size) {
+    int filled = 0;
+    while (filled < size) {
+        int ret = request->readBody(buffer + filled, size - filled);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            break;
+        }
+        filled += ret;
+    }
+    return filled;
+}
+
+// receive the whole request body before the transaction that writes it is
+// opened, so that a client that stalls mid-upload holds up nobody else. A
+// body that fits in chunk stays there and spool is NULL, a longer one is
+// copied chunk by chunk to a temporary file that spool is left at the
+// start of. Returns the body's length, -1 if the client went away, -2 if
+// the temporary file could not be written or BODY_TOO_LARGE once the body
+// is longer than limit, before any more of it is spooled
+static long receiveBody(HTTPRequest *request, std::vector<char> &chunk, long limit, FILE *&spool) {
+    spool = NULL;
+    if (request->getContentLength() > limit) {
+        return BODY_TOO_LARGE;
+    }
+    long total = 0;
+    while (true) {
+        int size = readBodyChunk(request, chunk.data(), chunk.size());
+        if (size < 0) {
+            return -1;
+        }
+        if (size > limit - total) {
+            // a chunked body, its length is only known as it arrives
+            return BODY_TOO_LARGE;
+        }
+        if (spool == NULL && total == 0 && size < (int) chunk.size()) {
+            return size;
+        }
+        if (spool == NULL && (spool = tmpfile()) == NULL) {
+            return -2;
+        }
+        if (fwrite(chunk.data(), 1, size, spool) != (size_t) size) {
+            return -2;
+        }
+        total += size;
+        if (size < (int) chunk.size()) {
+            if (fflush(spool) != 0 || fseek(spool, 0, SEEK_SET) != 0) {
+                return -2;
+            }
+            return total;
+        }
+    }
+}
+
+// write a body that receiveBody took in into the file at offset, a chunk at
+// a time. replace makes the body the file's whole content. Returns the
+// bytes written, fewer than length if the disk fills up, or a negative
+// error
+long DistributedFileSystemService::writeBody(int inodeId, int offset, bool replace, std::vector<char> &chunk,
+                                             long length, FILE *spool) {
+    long total = 0;
+    do {
+        int size = (int) length;
+        if (spool != NULL) {
+            size = (int) std::min((long) chunk.size(), length - total);
+            if (fread(chunk.data(), 1, size, spool) != (size_t) size) {
+                return -1;
+            }
+        }
+        int written;
+        if (replace && total == 0) {
+            written = fileSystem->write(inodeId, chunk.data(), size);
+        } else {
+            written = fileSystem->write(inodeId, chunk.data(), size, (int) (offset + total));
+        }
+        if (written < 0) {
+            return written;
+        }
+        total += written;
+        // the disk is full
+        if (written < size) {
+            return total;
+        }
+    } while (total < length);
+    return total;
+}
+
+// handle PUT requests: upload a file or create a directory. With a
+// Content-Range header only that range of the file is written, the rest
+// of it stays as it is
+void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *response) {
+    std::string requestedPath = request->getPath();
+
+    int first = 0;
+    int last = 0;
+    bool ranged = false;
+    std::string rangeHeader;
+    if (request->findHeader("Content-Range", rangeHeader)) {
+        long contentLength = request->getContentLength();
+        if (!parseContentRange(rangeHeader, first, last) ||
+            (contentLength >= 0 && last - first + 1 != contentLength)) {
+            response->setStatus(400);
+            response->setBody("Invalid Content-Range.");
+            return;
+        }
+        ranged = true;
+    }
+
+    // a ranged body one byte longer than its range is already wrong
+    long limit = fileSystem->maxFileSize;
+    if (ranged) {
+        limit = (last < fileSystem->maxFileSize) ? last - first + 2 : 0;
+    }
+    std::vector<char> chunk(UPLOAD_CHUNK_SIZE);
+    FILE *spool;
+    long length = receiveBody(request, chunk, limit, spool);
+    if (length == -1) {
+        response->setStatus(400);
+        response->setBody("Incomplete request body.");
+    } else if (length == BODY_TOO_LARGE && (!ranged || last >= fileSystem->maxFileSize)) {
+        response->setStatus(413);
+        response->setBody("File too large.");
+    } else if (length == -2) {
         response->setStatus(500);
         response->setBody("Failed to write file contents.");
+    } else if (ranged && length != last - first + 1) {
+        // a chunked body, its length is only known now
+        response->setStatus(400);
+        response->setBody("Invalid Content-Range.");
     } else {
-        response->setStatus(201);
-        response->setBody("File created successfully.");
+        // everything below is one transaction, so the whole PUT is flushed once
+        fileSystem->beginTransaction();
+        int fileInodeId = createFile(requestedPath, response);
+        if (fileInodeId >= 0) {
+            // write the content into the file
+            if (writeBody(fileInodeId, ranged ? first : 0, !ranged, chunk, length, spool) < 0) {
+                fileSystem->rollback();
+                response->setStatus(500);
+                response->setBody("Failed to write file contents.");
+            } else {
+                fileSystem->commit();
+                response->setStatus(201);
+                response->setBody("File created successfully.");
+            }
+        }
+    }
+    if (spool != NULL) {
+        fclose(spool);
+    }
+}
+
+// handle POST requests: append the body to a file, creating it if needed
+void DistributedFileSystemService::post(HTTPRequest *request, HTTPResponse *response) {
+    std::vector<char> chunk(UPLOAD_CHUNK_SIZE);
+    FILE *spool;
+    long limit = fileSystem->maxFileSize - fileSize(request->getPath());
+    long length = receiveBody(request, chunk, limit, spool);
+    if (length == -1) {
+        response->setStatus(400);
+        response->setBody("Incomplete request body.");
+    } else if (length == BODY_TOO_LARGE) {
+        response->setStatus(413);
+        response->setBody("File too large.");
+    } else if (length < 0) {
+        response->setStatus(500);
+        response->setBody("Failed to append to file.");
+    } else {
+        fileSystem->beginTransaction();
+        int fileInodeId = createFile(request->getPath(), response);
+        if (fileInodeId >= 0) {
+            // only the file's last block and the new ones are written
+            inode_t fileInode;
+            fileSystem->stat(fileInodeId, &fileInode);
+            long bytesWritten = writeBody(fileInodeId, fileInode.size, false, chunk, length, spool);
+            if (bytesWritten < 0) {
+                fileSystem->rollback();
+                response->setStatus(500);
+                response->setBody("Failed to append to file.");
+            } else {
+                fileSystem->commit();
+                response->setStatus(200);
+                response->setBody("Appended " + std::to_string(bytesWritten) + " bytes.");
+            }
+        }
+    }
+    if (spool != NULL) {
+        fclose(spool);
     }
 }
 
@@ -288,14 +671,15 @@ void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *respo
     if (targetInode.type == UFS_DIRECTORY) {
         // check if the directory is empty
         std::vector<char> directoryBuffer(targetInode.size);
-        if (fileSystem->read(targetInodeId, directoryBuffer.data(), targetInode.size) < 0) {
+        int bytesRead = fileSystem->read(targetInodeId, directoryBuffer.data(), targetInode.size);
+        if (bytesRead < 0) {
             response->setStatus(500);
             response->setBody("Failed to read directory.");
             return;
         }
         dir_ent_t *directoryEntries = reinterpret_cast<dir_ent_t *>(directoryBuffer.data());
         int validEntries = 0;
-        for (size_t i = 0; i < targetInode.size / sizeof(dir_ent_t); i++) {
+        for (size_t i = 0; i < bytesRead / sizeof(dir_ent_t); i++) {
             if (directoryEntries[i].inum != -1 && directoryEntries[i].name[0] != '\0') {
                 std::string entryName = directoryEntries[i].name;
                 if (entryName != "." && entryName != "..") {
@@ -311,11 +695,14 @@ void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *respo
     }
     
     // remove the file or directory
+    fileSystem->beginTransaction();
     int result = fileSystem->unlink(parentInodeId, targetName);
     if (result < 0) {
+        fileSystem->rollback();
         response->setStatus(500);
         response->setBody("Failed to delete file or directory.");
     } else {
+        fileSystem->commit();
         response->setStatus(200);
         response->setBody("File or directory deleted successfully.");
     }
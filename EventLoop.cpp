@@ -0,0 +1,322 @@
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "EventLoop.h"
+#include "dthread.h"
+
+using namespace std;
+
+// events handled per epoll_wait, and bytes read per readable event so that
+// one busy client cannot starve the rest
+#define EVENT_LOOP_EVENTS     (256)
+#define EVENT_LOOP_READ_SIZE  (65536)
+
+// how often idle connections are looked for, in milliseconds
+#define EVENT_LOOP_SWEEP_INTERVAL (1000)
+
+static time_t monotonicSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec;
+}
+
+EventLoop::EventLoop(MyServerSocket *server, int serverPort, RequestHandler handler, int idleTimeout,
+                     bool blockingHandoff) {
+  m_server = server;
+  m_serverPort = serverPort;
+  m_handler = handler;
+  m_blockingHandoff = blockingHandoff;
+  m_idleTimeout = idleTimeout;
+  m_handlerReady = false;
+  pthread_mutex_init(&m_resumeLock, NULL);
+
+  m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epollFd < 0) {
+    perror("epoll_create1");
+    exit(1);
+  }
+
+  m_server->setNonBlocking();
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = m_server->getFd();
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_server->getFd(), &event) < 0) {
+    perror("epoll_ctl");
+    exit(1);
+  }
+
+  m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_wakeFd < 0) {
+    perror("eventfd");
+    exit(1);
+  }
+  event.events = EPOLLIN;
+  event.data.fd = m_wakeFd;
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &event) < 0) {
+    perror("epoll_ctl");
+    exit(1);
+  }
+}
+
+void EventLoop::run() {
+  struct epoll_event events[EVENT_LOOP_EVENTS];
+  int timeout = m_idleTimeout > 0 ? EVENT_LOOP_SWEEP_INTERVAL : -1;
+  time_t lastSweep = monotonicSeconds();
+  while (true) {
+    int ready = epoll_wait(m_epollFd, events, EVENT_LOOP_EVENTS, timeout);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      exit(1);
+    }
+
+    for (int idx = 0; idx < ready; idx++) {
+      if (events[idx].data.fd == m_server->getFd()) {
+        acceptConnections();
+      } else if (events[idx].data.fd == m_wakeFd) {
+        wakeUp();
+      } else if (m_writers.count(events[idx].data.fd) > 0) {
+        runWriter(events[idx].data.fd);
+      } else {
+        readFromConnection(events[idx].data.fd);
+      }
+    }
+
+    if (m_idleTimeout > 0 && monotonicSeconds() != lastSweep) {
+      lastSweep = monotonicSeconds();
+      closeIdleConnections();
+    }
+  }
+}
+
+void EventLoop::resume(MySocket *client, HTTPRequest *request) {
+  Connection connection;
+  connection.socket = client;
+  connection.request = request;
+  pthread_mutex_lock(&m_resumeLock);
+  m_resumed.push_back(connection);
+  pthread_mutex_unlock(&m_resumeLock);
+
+  uint64_t one = 1;
+  if (::write(m_wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    perror("eventfd write");
+  }
+}
+
+void EventLoop::post(Callback callback, void *arg) {
+  PendingCallback posted;
+  posted.callback = callback;
+  posted.arg = arg;
+  pthread_mutex_lock(&m_resumeLock);
+  m_posted.push_back(posted);
+  pthread_mutex_unlock(&m_resumeLock);
+
+  uint64_t one = 1;
+  if (::write(m_wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    perror("eventfd write");
+  }
+}
+
+void EventLoop::handlerReady() {
+  pthread_mutex_lock(&m_resumeLock);
+  m_handlerReady = true;
+  pthread_mutex_unlock(&m_resumeLock);
+
+  uint64_t one = 1;
+  if (::write(m_wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    perror("eventfd write");
+  }
+}
+
+void EventLoop::wakeUp() {
+  uint64_t count;
+  if (::read(m_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    perror("eventfd read");
+  }
+
+  vector<Connection> resumed;
+  vector<PendingCallback> posted;
+  pthread_mutex_lock(&m_resumeLock);
+  resumed.swap(m_resumed);
+  posted.swap(m_posted);
+  bool handlerReady = m_handlerReady;
+  m_handlerReady = false;
+  pthread_mutex_unlock(&m_resumeLock);
+
+  resumeConnections(resumed);
+  if (handlerReady) {
+    handOffParked();
+  }
+  // anything these post in turn waits for the next wake up, so that a
+  // busy poster cannot keep the loop from its sockets
+  for (unsigned int idx = 0; idx < posted.size(); idx++) {
+    posted[idx].callback(posted[idx].arg);
+  }
+}
+
+void EventLoop::resumeConnections(vector<Connection> &resumed) {
+  for (unsigned int idx = 0; idx < resumed.size(); idx++) {
+    try {
+      if (m_blockingHandoff) {
+        resumed[idx].socket->setNonBlocking(true);
+      }
+    } catch (SocketError &e) {
+      delete resumed[idx].request;
+      delete resumed[idx].socket;
+      continue;
+    }
+    addConnection(resumed[idx].socket, resumed[idx].request);
+  }
+}
+
+void EventLoop::acceptConnections() {
+  sync_print("waiting_to_accept", "");
+  while (true) {
+    MySocket *client;
+    try {
+      client = m_server->tryAccept();
+    } catch (SocketError &e) {
+      // out of file descriptors, most likely. Try again on the next event
+      cerr << e.what() << endl;
+      return;
+    }
+    if (client == NULL) {
+      return;
+    }
+    sync_print("client_accepted", "");
+    addConnection(client, new HTTPRequest(client, m_serverPort));
+  }
+}
+
+void EventLoop::addConnection(MySocket *client, HTTPRequest *request) {
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.fd = client->getFd();
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, client->getFd(), &event) < 0) {
+    perror("epoll_ctl");
+    delete request;
+    delete client;
+    return;
+  }
+  Connection connection;
+  connection.socket = client;
+  connection.request = request;
+  connection.lastActive = monotonicSeconds();
+  m_connections[client->getFd()] = connection;
+}
+
+void EventLoop::readFromConnection(int fd) {
+  unordered_map<int, Connection>::iterator iter = m_connections.find(fd);
+  if (iter == m_connections.end()) {
+    return;
+  }
+  iter->second.lastActive = monotonicSeconds();
+  Connection connection = iter->second;
+
+  char buffer[EVENT_LOOP_READ_SIZE];
+  ssize_t ret = ::read(fd, buffer, sizeof(buffer));
+  if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return;
+  }
+  if (ret <= 0) {
+    // the client went away before finishing its request
+    closeConnection(fd);
+    return;
+  }
+
+  if (connection.request->addData(buffer, ret) < 0) {
+    stringstream payload;
+    payload << "client: " << (void *) connection.socket;
+    sync_print("read_request_error", payload.str());
+    closeConnection(fd);
+    return;
+  }
+  if (!connection.request->isReady()) {
+    return;
+  }
+
+  // complete, or far enough along to stream its body, the handler owns the connection from here on
+  epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, NULL);
+  m_connections.erase(iter);
+  try {
+    if (m_blockingHandoff) {
+      connection.socket->setNonBlocking(false);
+    }
+  } catch (SocketError &e) {
+    delete connection.request;
+    delete connection.socket;
+    return;
+  }
+  handOff(connection);
+}
+
+void EventLoop::handOff(Connection &connection) {
+  // behind any that are already waiting, so that they go in order
+  if (!m_parked.empty() || !m_handler(connection.socket, connection.request)) {
+    m_parked.push_back(connection);
+  }
+}
+
+void EventLoop::handOffParked() {
+  while (!m_parked.empty() && m_handler(m_parked.front().socket, m_parked.front().request)) {
+    m_parked.pop_front();
+  }
+}
+
+void EventLoop::whenWritable(int fd, Callback callback, void *arg) {
+  struct epoll_event event;
+  event.events = EPOLLOUT;
+  event.data.fd = fd;
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    // not something epoll can wait on, let the write find out why
+    perror("epoll_ctl");
+    callback(arg);
+    return;
+  }
+  PendingCallback writer;
+  writer.callback = callback;
+  writer.arg = arg;
+  m_writers[fd] = writer;
+}
+
+void EventLoop::runWriter(int fd) {
+  unordered_map<int, PendingCallback>::iterator iter = m_writers.find(fd);
+  PendingCallback writer = iter->second;
+  epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, NULL);
+  m_writers.erase(iter);
+  writer.callback(writer.arg);
+}
+
+void EventLoop::closeConnection(int fd) {
+  unordered_map<int, Connection>::iterator iter = m_connections.find(fd);
+  if (iter == m_connections.end()) {
+    return;
+  }
+  epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, NULL);
+  delete iter->second.request;
+  delete iter->second.socket;
+  m_connections.erase(iter);
+}
+
+void EventLoop::closeIdleConnections() {
+  time_t cutoff = monotonicSeconds() - m_idleTimeout;
+  vector<int> idle;
+  for (unordered_map<int, Connection>::iterator iter = m_connections.begin(); iter != m_connections.end(); iter++) {
+    if (iter->second.lastActive <= cutoff) {
+      idle.push_back(iter->first);
+    }
+  }
+  for (unsigned int idx = 0; idx < idle.size(); idx++) {
+    closeConnection(idle[idx]);
+  }
+}
@@ -2,6 +2,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include <iostream>
 #include <map>
@@ -44,6 +45,16 @@ void FileService::get(HTTPRequest *request, HTTPResponse *response) {
   }
 }
 
+long FileService::requestSize(HTTPRequest *request) {
+  // the size of the file a GET would send, without reading it
+  struct stat info;
+  string path = this->m_basedir + request->getPath();
+  if (stat(path.c_str(), &info) != 0) {
+    return 0;
+  }
+  return info.st_size;
+}
+
 string FileService::readFile(string path) {
   int fd = open(path.c_str(), O_RDONLY);
   if (fd < 0) {
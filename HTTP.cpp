@@ -1,5 +1,6 @@
 #include "HTTP.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 
@@ -80,6 +81,11 @@ int HTTP::headers_complete_cb(http_parser *parser)
     HTTP *http = (HTTP *) parser->data;
     http->addHeaderField();
     http->m_headerDone = true;
+    http->m_contentLength = (long) parser->content_length;
+    if(http->m_httpType == HTTP_REQUEST) {
+        // known now, for a request whose body is streamed
+        http->m_method = parser->method;
+    }
 
     if(http->m_httpType == HTTP_RESPONSE) {
         char buf[64];
@@ -127,11 +133,19 @@ int HTTP::body_cb(http_parser *parser, const char *at, size_t length)
 int HTTP::message_complete_cb(http_parser *parser)
 {
     HTTP *http = (HTTP *) parser->data;
-    assert((http->getState() == HTTP::VALUE) || 
+    // HEADER for a message without any header fields, which HTTP/1.0
+    // clients send
+    assert((http->getState() == HTTP::HEADER) ||
+           (http->getState() == HTTP::VALUE) || 
            (http->getState() == HTTP::BODY));
     http->setState(HTTP::DONE);
+    http->m_keepAlive = http_should_keep_alive(parser);
     http->messageComplete(parser->method);
-    return 0;
+
+    // stop at the end of this message, whatever follows it belongs to the
+    // next one. The parser does not count the byte it stopped on
+    http->m_extraParsedBytes = 1;
+    return -1;
 }
 
 /****************************************************************************/
@@ -148,6 +162,8 @@ HTTP::HTTP(http_parser_type httpType)
     m_doneParsing = false;
     m_httpType = httpType;
     m_headerDone = false;
+    m_keepAlive = false;
+    m_contentLength = -1;
 
     m_settings.on_message_begin = message_begin_cb;
     m_settings.on_path = path_cb;
@@ -183,6 +199,39 @@ HTTP::~HTTP()
     }
 }
 
+void HTTP::reset()
+{
+    http_parser_init(&m_parser, m_httpType);
+    m_parser.data = this;
+    m_state = INIT;
+    m_doneParsing = false;
+    m_headerDone = false;
+    m_keepAlive = false;
+    m_contentLength = -1;
+    m_extraParsedBytes = 0;
+
+    if(m_field != NULL) {
+        delete m_field;
+        m_field = NULL;
+    }
+    if(m_value != NULL) {
+        delete m_value;
+        m_value = NULL;
+    }
+    for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
+        delete m_headers[idx].first;
+        delete m_headers[idx].second;
+    }
+    m_headers.clear();
+
+    m_url.clear();
+    m_path.clear();
+    m_query.clear();
+    m_host.clear();
+    m_body.clear();
+    m_statusStr.clear();
+}
+
 int HTTP::addData(const unsigned char *data, int len)
 {
     if(m_doneParsing) {
@@ -199,6 +248,14 @@ string HTTP::getBody()
     return m_body;
 }
 
+int HTTP::takeBody(char *buffer, int size)
+{
+    int taken = min(size, (int) m_body.size());
+    m_body.copy(buffer, taken);
+    m_body.erase(0, taken);
+    return taken;
+}
+
 string HTTP::getUrl()
 {
     return m_url;
@@ -5,6 +5,9 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
+#include <strings.h>
+#include <time.h>
 
 #include "HttpUtils.h"
 #include "StringUtils.h"
@@ -13,6 +16,16 @@ using namespace std;
 
 #define CONNECT_REPLY "HTTP/1.1 200 Connection Established\r\n\r\n"
 
+// longer bodies are left for the service to stream with readBody(), so
+// that an upload does not have to fit in memory
+#define MAX_BUFFERED_BODY (64 * 1024)
+
+static long long monotonicMillis() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
 HTTPRequest::HTTPRequest(MySocket *sock, int serverPort)
 {
     m_sock = sock;
@@ -20,6 +33,8 @@ HTTPRequest::HTTPRequest(MySocket *sock, int serverPort)
     m_serverPort = serverPort;
     m_totalBytesRead = 0;
     m_totalBytesWritten = 0;
+    m_requestCount = 1;
+    m_bodyDeadline = 0;
 }
 
 HTTPRequest::~HTTPRequest()
@@ -40,10 +55,19 @@ map<string, string> HTTPRequest::getParams() {
 }
 
 WwwFormEncodedDict HTTPRequest::formEncodedBody() {
-  WwwFormEncodedDict dict(m_http->getBody());
+  WwwFormEncodedDict dict(getBody());
   return dict;
 }
 
+string HTTPRequest::getBody() {
+  while (!m_http->isDone()) {
+    if (!readMoreBody(BODY_IDLE_TIMEOUT_MILLIS)) {
+      break;
+    }
+  }
+  return m_http->getBody();
+}
+
 string HTTPRequest::getPath() {
   return m_http->getPath();
 }
@@ -61,6 +85,17 @@ string HTTPRequest::getHeader(string key) {
   throw "could not find header";
 }
 
+bool HTTPRequest::findHeader(string key, string &value) {
+  vector<pair<string *, string *> > headers = m_http->getHeaders();
+  for (unsigned int idx = 0; idx < headers.size(); idx++) {
+    if (strcasecmp(headers[idx].first->c_str(), key.c_str()) == 0) {
+      value = *headers[idx].second;
+      return true;
+    }
+  }
+  return false;
+}
+
 bool HTTPRequest::hasAuthToken() {
   try {
     getHeader("x-auth-token");
@@ -82,44 +117,133 @@ vector<string> HTTPRequest::getPathComponents() {
   return StringUtils::split(getPath(), '/');
 }
 
-bool HTTPRequest::readRequest()
+bool HTTPRequest::readRequest(int idleTimeoutMillis, int timeoutMillis)
 {
     assert(!m_http->isDone());
 
+    long long deadline = (timeoutMillis < 0) ? 0 : monotonicMillis() + timeoutMillis;
+    while(!isReady()) {
+        int waitMillis = idleTimeoutMillis;
+        if(deadline != 0) {
+            long long left = deadline - monotonicMillis();
+            if(left <= 0) {
+                return false;
+            }
+            if(waitMillis < 0 || waitMillis > left) {
+                waitMillis = (int) left;
+            }
+        }
+        if(!readMore(waitMillis)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool HTTPRequest::isReady()
+{
+    if(m_http->isDone()) {
+        return true;
+    }
+    if(!m_http->isHeaderDone()) {
+        return false;
+    }
+    long contentLength = m_http->getContentLength();
+    return contentLength < 0 || contentLength > MAX_BUFFERED_BODY;
+}
+
+bool HTTPRequest::readMore(int idleTimeoutMillis)
+{
+    // a non-blocking socket, from an event loop, is read once poll says so
+    struct pollfd pfd;
+    pfd.fd = m_sock->getFd();
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, idleTimeoutMillis) <= 0) {
+        return false;
+    }
     string readData;
-    while(!m_http->isDone()) {
+    try {
         readData = m_sock->read();
-	onRead(readData.c_str(), readData.size());
+    } catch(...) {
+        return false;
     }
+    return addData(readData.c_str(), readData.size()) >= 0;
+}
 
-    return true;
+bool HTTPRequest::readMoreBody(int idleTimeoutMillis)
+{
+    // an idle timeout alone lets a client that sends a byte now and then
+    // keep a service reading forever
+    long long now = monotonicMillis();
+    if(m_bodyDeadline == 0) {
+        m_bodyDeadline = now + BODY_TIMEOUT_MILLIS;
+    }
+    if(now >= m_bodyDeadline) {
+        return false;
+    }
+    long long left = m_bodyDeadline - now;
+    if(idleTimeoutMillis < 0 || idleTimeoutMillis > left) {
+        idleTimeoutMillis = (int) left;
+    }
+    return readMore(idleTimeoutMillis);
+}
+
+int HTTPRequest::readBody(char *buffer, int size, int idleTimeoutMillis)
+{
+    int taken = m_http->takeBody(buffer, size);
+    while(taken == 0 && !m_http->isDone()) {
+        if(!readMoreBody(idleTimeoutMillis)) {
+            return -1;
+        }
+        taken = m_http->takeBody(buffer, size);
+    }
+    return taken;
 }
 
-void HTTPRequest::onRead(const char *buffer, unsigned int len)
+bool HTTPRequest::finishBody(int idleTimeoutMillis)
 {
-    m_totalBytesRead += len;
+    char buffer[4096];
+    int ret;
+    while((ret = readBody(buffer, sizeof(buffer), idleTimeoutMillis)) > 0) {
+        // drop it
+    }
+    return ret == 0;
+}
 
+int HTTPRequest::addData(const char *buffer, unsigned int len)
+{
     unsigned int bytesRead = 0;
-    assert(len > 0);
 
-    while(bytesRead < len) {
-        assert(!m_http->isDone());
+    // the parser stops at the end of the request, so anything after it is
+    // left for the caller
+    while(bytesRead < len && !m_http->isDone()) {
         int ret = m_http->addData((const unsigned char *) (buffer + bytesRead), len - bytesRead);
-        assert(ret > 0);
-        bytesRead += ret;
-        
-        // This is a workaround for a parsing bug that sometimes
-        // crops up with connect commands.  The parser will think
-        // it is done before it reads the last newline of some
-        // properly formatted connect requests
-        if(m_http->isDone() && (bytesRead < len)) {
-            if(m_http->isConnect() && ((len-bytesRead) == 1) && (buffer[bytesRead] == '\n')) {
-                break;
-            } else {
-                assert(false);
-            }
+        if(ret <= 0) {
+            return -1;
         }
+        bytesRead += ret;
+    }
+    if(bytesRead < len) {
+        m_pending.append(buffer + bytesRead, len - bytesRead);
+    }
+
+    m_totalBytesRead += bytesRead;
+    return bytesRead;
+}
+
+bool HTTPRequest::reset()
+{
+    m_http->reset();
+    m_requestCount++;
+    m_bodyDeadline = 0;
+
+    string pending;
+    pending.swap(m_pending);
+    if(pending.empty()) {
+        return true;
     }
+    return addData(pending.data(), pending.size()) >= 0;
 }
 
 string HTTPRequest::getHost()
@@ -6,6 +6,7 @@ using namespace std;
 
 HTTPResponse::HTTPResponse() {
   this->streaming = false;
+  this->contentLength = -1;
   this->contentType = "text/html; charset=ISO-8859-1";
   this->headers["Server"] = "Gunrock Web";
   this->status = 200;
@@ -23,6 +24,10 @@ void HTTPResponse::setBody(string data) {
   body = data;
 }
 
+void HTTPResponse::setContentLength(long length) {
+  contentLength = length;
+}
+
 int HTTPResponse::getStatus() {
   return status;
 }
@@ -50,7 +55,11 @@ string HTTPResponse::response() {
     setHeader("Transfer-Encoding", "chunked");
   } else {
     stringstream len;
-    len << body.size();
+    if (contentLength >= 0) {
+      len << contentLength;
+    } else {
+      len << body.size();
+    }
     setHeader("Content-Length", len.str());
   }
 
@@ -60,7 +69,7 @@ string HTTPResponse::response() {
     out << iter->first << ": " << iter->second << "\r\n";
   }
   out << "\r\n";
-  if (body.size() > 0 && !streaming) {
+  if (body.size() > 0 && !streaming && contentLength < 0) {
     out << body;
   }
 
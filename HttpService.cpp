@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 
 #include <stdlib.h>
@@ -41,6 +42,10 @@ void HttpService::del(HTTPRequest *request, HTTPResponse *response) {
   throw ClientError::methodNotAllowed();
 }
 
+long HttpService::requestSize(HTTPRequest *request) {
+  return max(request->getContentLength(), 0L);
+}
+
 void HttpService::move(HTTPRequest *request, HTTPResponse *response) {
   cout << "MOVE " << request->getPath() << endl;
   throw ClientError::methodNotAllowed();
@@ -0,0 +1,225 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+
+#include <cstring>
+#include <iostream>
+
+#include "IoRing.h"
+
+using namespace std;
+
+IoRing *IoRing::open(unsigned int entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) {
+    return NULL;
+  }
+  return new IoRing(fd, params);
+}
+
+static void *mapRing(int fd, size_t length, off_t offset) {
+  void *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (mapping == MAP_FAILED) {
+    perror("mmap");
+    cerr << "Could not map io_uring" << endl;
+    exit(1);
+  }
+  return mapping;
+}
+
+IoRing::IoRing(int fd, struct io_uring_params &params) {
+  m_fd = fd;
+  m_entries = params.sq_entries;
+  m_reaping = false;
+  pthread_mutex_init(&m_submitLock, NULL);
+  pthread_mutex_init(&m_completionLock, NULL);
+  pthread_cond_init(&m_completed, NULL);
+
+  // newer kernels put both queues in one mapping
+  m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    m_sqRingSize = max(m_sqRingSize, m_cqRingSize);
+    m_cqRingSize = 0;
+  }
+  m_sqRing = mapRing(fd, m_sqRingSize, IORING_OFF_SQ_RING);
+  m_cqRing = (m_cqRingSize == 0) ? m_sqRing : mapRing(fd, m_cqRingSize, IORING_OFF_CQ_RING);
+  m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  m_sqes = (struct io_uring_sqe *) mapRing(fd, m_sqesSize, IORING_OFF_SQES);
+
+  unsigned char *sq = (unsigned char *) m_sqRing;
+  m_sqHead = (unsigned int *) (sq + params.sq_off.head);
+  m_sqTail = (unsigned int *) (sq + params.sq_off.tail);
+  m_sqMask = (unsigned int *) (sq + params.sq_off.ring_mask);
+  m_sqArray = (unsigned int *) (sq + params.sq_off.array);
+  unsigned char *cq = (unsigned char *) m_cqRing;
+  m_cqHead = (unsigned int *) (cq + params.cq_off.head);
+  m_cqTail = (unsigned int *) (cq + params.cq_off.tail);
+  m_cqMask = (unsigned int *) (cq + params.cq_off.ring_mask);
+  m_cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+}
+
+IoRing::~IoRing() {
+  munmap(m_sqes, m_sqesSize);
+  if (m_cqRingSize != 0) {
+    munmap(m_cqRing, m_cqRingSize);
+  }
+  munmap(m_sqRing, m_sqRingSize);
+  close(m_fd);
+  pthread_mutex_destroy(&m_submitLock);
+  pthread_mutex_destroy(&m_completionLock);
+  pthread_cond_destroy(&m_completed);
+}
+
+int IoRing::enter(unsigned int toSubmit, unsigned int minComplete, unsigned int flags) {
+  return syscall(__NR_io_uring_enter, m_fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+int IoRing::run(Operation *operations, int count) {
+  int failed = 0;
+  for (int first = 0; first < count; first += m_entries) {
+    int round = min(count - first, (int) m_entries);
+    if (failed != 0) {
+      // the rest of a chain that broke, or more of a batch that has failed
+      for (int i = first; i < first + round; i++) {
+        operations[i].result = -ECANCELED;
+        operations[i].done = true;
+      }
+      continue;
+    }
+
+    // a chain that goes on in the next round is kept in order by waiting
+    // for this one, the kernel only links within one submission
+    Operation &last = operations[first + round - 1];
+    bool link = last.link;
+    last.link = false;
+    submit(operations + first, round);
+    wait(operations + first, round);
+    last.link = link;
+
+    for (int i = first; i < first + round && failed == 0; i++) {
+      if (operations[i].result < 0) {
+        failed = operations[i].result;
+      }
+    }
+  }
+  return failed;
+}
+
+void IoRing::submit(Operation *operations, int count) {
+  pthread_mutex_lock(&m_submitLock);
+  // the kernel takes everything we queue before enter returns, so the
+  // whole queue is free here
+  unsigned int tail = *m_sqTail;
+  for (int i = 0; i < count; i++) {
+    Operation &operation = operations[i];
+    operation.done = false;
+    unsigned int index = (tail + i) & *m_sqMask;
+    struct io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = operation.fd;
+    if (operation.type == DATA_SYNC) {
+      sqe->opcode = IORING_OP_FSYNC;
+      sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    } else {
+      sqe->opcode = (operation.type == READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+      sqe->addr = (uint64_t) (uintptr_t) operation.buffers;
+      sqe->len = operation.count;
+      sqe->off = operation.offset;
+    }
+    if (operation.link && i < count - 1) {
+      sqe->flags = IOSQE_IO_LINK;
+    }
+    sqe->user_data = (uint64_t) (uintptr_t) &operation;
+    m_sqArray[index] = index;
+  }
+  __atomic_store_n(m_sqTail, tail + count, __ATOMIC_RELEASE);
+
+  int submitted = 0;
+  while (submitted < count) {
+    int ret = enter(count - submitted, 0, 0);
+    if (ret >= 0) {
+      submitted += ret;
+    } else if (errno == EBUSY || errno == EAGAIN) {
+      // completions are piling up, make room for more
+      pthread_mutex_lock(&m_completionLock);
+      if (reapCompletions() > 0) {
+        pthread_cond_broadcast(&m_completed);
+      }
+      pthread_mutex_unlock(&m_completionLock);
+      sched_yield();
+    } else if (errno != EINTR) {
+      perror("io_uring_enter");
+      cerr << "Could not submit to io_uring" << endl;
+      exit(1);
+    }
+  }
+  pthread_mutex_unlock(&m_submitLock);
+}
+
+void IoRing::wait(Operation *operations, int count) {
+  pthread_mutex_lock(&m_completionLock);
+  int next = 0;
+  while (true) {
+    while (next < count && operations[next].done) {
+      next++;
+    }
+    if (next == count) {
+      break;
+    }
+    if (m_reaping) {
+      pthread_cond_wait(&m_completed, &m_completionLock);
+      continue;
+    }
+    if (reapCompletions() > 0) {
+      pthread_cond_broadcast(&m_completed);
+      continue;
+    }
+
+    // nothing yet. Sleep in the kernel until something completes, nobody
+    // else reaps meanwhile so that the completion that wakes us is still
+    // there when we look
+    m_reaping = true;
+    pthread_mutex_unlock(&m_completionLock);
+    if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+      perror("io_uring_enter");
+      cerr << "Could not wait for io_uring" << endl;
+      exit(1);
+    }
+    pthread_mutex_lock(&m_completionLock);
+    m_reaping = false;
+    reapCompletions();
+    pthread_cond_broadcast(&m_completed);
+  }
+  pthread_mutex_unlock(&m_completionLock);
+}
+
+int IoRing::reapCompletions() {
+  unsigned int head = *m_cqHead;
+  unsigned int tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+  // the operations were filled in before submit() released the submission
+  // tail, and the kernel only completes what it was given after that. This
+  // makes the order explicit for the compiler and for thread sanitizers
+  __atomic_load_n(m_sqTail, __ATOMIC_ACQUIRE);
+  int reaped = 0;
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &m_cqes[head & *m_cqMask];
+    Operation *operation = (Operation *) (uintptr_t) cqe->user_data;
+    operation->result = cqe->res;
+    operation->done = true;
+    if (operation->callback != NULL) {
+      operation->callback(operation->arg, operation->result);
+    }
+    head++;
+    reaped++;
+  }
+  __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+  return reaped;
+}
@@ -4,107 +4,805 @@
 #include <cassert>
 #include <cstring>
 #include <algorithm> 
+#include <unordered_map>
+#include <cstdint>
+#include <endian.h>
+#include <sched.h>
 #include "LocalFileSystem.h"
 #include "ufs.h"
 
 using namespace std;
 
+// Bitmap scanning helpers. Bit i of a bitmap lives in byte i / 8, so loading
+// eight bytes as a little-endian word puts bit i at position i % 64 of word
+// i / 64 and a whole word can be tested with one ctz. Bitmaps are whole
+// blocks, so a word never runs off the end of the buffer.
+static inline uint64_t bitmapWord(const unsigned char *bitmap, int word) {
+  uint64_t value;
+  memcpy(&value, bitmap + word * sizeof(uint64_t), sizeof(uint64_t));
+  return le64toh(value);
+}
+
+// first clear bit in [from, to), or -1
+static int findClearBit(const unsigned char *bitmap, int from, int to) {
+  for (int bit = from; bit < to; ) {
+    int word = bit / 64;
+    uint64_t free = ~bitmapWord(bitmap, word) & (~0ULL << (bit % 64));
+    if (free != 0) {
+      int found = word * 64 + __builtin_ctzll(free);
+      return found < to ? found : -1;
+    }
+    bit = (word + 1) * 64;
+  }
+  return -1;
+}
+
+// first set bit in [from, to), or to
+static int findSetBit(const unsigned char *bitmap, int from, int to) {
+  for (int bit = from; bit < to; ) {
+    int word = bit / 64;
+    uint64_t used = bitmapWord(bitmap, word) & (~0ULL << (bit % 64));
+    if (used != 0) {
+      int found = word * 64 + __builtin_ctzll(used);
+      return found < to ? found : to;
+    }
+    bit = (word + 1) * 64;
+  }
+  return to;
+}
+
+// number of clear bits in [0, numBits)
+static int countClearBits(const unsigned char *bitmap, int numBits) {
+  int used = 0;
+  for (int word = 0; word < numBits / 64; word++) {
+    used += __builtin_popcountll(bitmapWord(bitmap, word));
+  }
+  if (numBits % 64 != 0) {
+    uint64_t mask = (1ULL << (numBits % 64)) - 1;
+    used += __builtin_popcountll(bitmapWord(bitmap, numBits / 64) & mask);
+  }
+  return numBits - used;
+}
+
+static void setBit(unsigned char *bitmap, int bit) {
+  bitmap[bit / 8] |= (1 << (bit % 8));
+}
+
+// returns whether the bit was set, so callers can keep free counts exact
+static bool clearBit(unsigned char *bitmap, int bit) {
+  bool wasSet = (bitmap[bit / 8] & (1 << (bit % 8))) != 0;
+  bitmap[bit / 8] &= ~(1 << (bit % 8));
+  return wasSet;
+}
+
+// Claim a run of up to `want` clear bits, searching next-fit from `hint` and
+// wrapping around once. The first run that is long enough wins; if there is
+// none, the longest one found is taken. Returns its first bit and sets
+// `length`, or returns -1 when the bitmap is full.
+static int allocateRun(unsigned char *bitmap, int numBits, int hint, int want, int *length) {
+  if (hint < 0 || hint >= numBits) {
+    hint = 0;
+  }
+
+  int bestStart = -1;
+  int bestLength = 0;
+  for (int pass = 0; pass < 2 && bestLength < want; pass++) {
+    int bit = (pass == 0) ? hint : 0;
+    int end = (pass == 0) ? numBits : hint;
+    while (bit < end) {
+      int start = findClearBit(bitmap, bit, end);
+      if (start == -1) {
+        break;
+      }
+      int stop = findSetBit(bitmap, start, min(end, start + want));
+      if (stop - start > bestLength) {
+        bestStart = start;
+        bestLength = stop - start;
+        if (bestLength == want) {
+          break;
+        }
+      }
+      bit = stop;
+    }
+  }
+
+  for (int i = 0; i < bestLength; i++) {
+    setBit(bitmap, bestStart + i);
+  }
+  *length = bestLength;
+  return bestStart;
+}
+
+static int allocateBit(unsigned char *bitmap, int numBits, int hint) {
+  int length;
+  return allocateRun(bitmap, numBits, hint, 1, &length);
+}
+
+// point blockNumbers[i] and buffers[i] at blocks[i] and the i-th block of
+// buffer, for the vectored Disk calls
+static void blockVector(const vector<unsigned int> &blocks, int count, unsigned char *buffer,
+                        vector<int> &blockNumbers, vector<struct iovec> &buffers) {
+  blockNumbers.resize(count);
+  buffers.resize(count);
+  for (int i = 0; i < count; i++) {
+    blockNumbers[i] = blocks[i];
+    buffers[i].iov_base = buffer + (size_t) i * UFS_BLOCK_SIZE;
+    buffers[i].iov_len = UFS_BLOCK_SIZE;
+  }
+}
+
 //good
 LocalFileSystem::LocalFileSystem(Disk *disk) {
   this->disk = disk;
+  pthread_rwlock_init(&this->indexLock, NULL);
+  pthread_mutex_init(&this->transactionLock, NULL);
+  pthread_mutex_init(&this->publishLock, NULL);
+  pthread_cond_init(&this->published, NULL);
+
+  // the superblock never changes at runtime, so read it once
+  char block[UFS_BLOCK_SIZE];
+  disk->readBlock(0, block);
+  memcpy(&superBlock, block, sizeof(super_t));
+
+  int numBlocks = disk->numberOfBlocks();
+  bool valid = superBlock.inode_bitmap_addr > 0 && superBlock.inode_bitmap_len > 0 &&
+    superBlock.data_bitmap_addr > 0 && superBlock.data_bitmap_len > 0 &&
+    superBlock.inode_region_addr > 0 && superBlock.inode_region_len > 0 &&
+    superBlock.data_region_addr > 0 && superBlock.data_region_len > 0 &&
+    superBlock.inode_bitmap_addr + superBlock.inode_bitmap_len <= numBlocks &&
+    superBlock.data_bitmap_addr + superBlock.data_bitmap_len <= numBlocks &&
+    superBlock.inode_region_addr + superBlock.inode_region_len <= numBlocks &&
+    superBlock.data_region_addr + superBlock.data_region_len <= numBlocks &&
+    superBlock.num_inodes > 0 && superBlock.num_inodes <= superBlock.inode_bitmap_len * UFS_BLOCK_SIZE * 8 &&
+    superBlock.num_data > 0 && superBlock.num_data <= superBlock.data_bitmap_len * UFS_BLOCK_SIZE * 8;
+  if (!valid) {
+    cerr << "Invalid superblock" << endl;
+    exit(1);
+  }
+  if (superBlock.version != UFS_VERSION_DIRECT && superBlock.version != UFS_VERSION_INDIRECT &&
+      superBlock.version != UFS_VERSION_EXTENT) {
+    cerr << "Unsupported file system version " << superBlock.version << endl;
+    exit(1);
+  }
+
+  inodesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
+  inodeRegionCapacity = superBlock.inode_region_len * inodesPerBlock;
+  inodeBitmapSize = superBlock.inode_bitmap_len * UFS_BLOCK_SIZE;
+  dataBitmapSize = superBlock.data_bitmap_len * UFS_BLOCK_SIZE;
+
+  if (superBlock.version == UFS_VERSION_DIRECT) {
+    directPointers = DIRECT_PTRS;
+    maxFileSize = MAX_FILE_SIZE;
+  } else if (superBlock.version == UFS_VERSION_INDIRECT) {
+    directPointers = NUM_DIRECT_INDIRECT;
+    maxFileSize = MAX_FILE_SIZE_INDIRECT;
+  } else {
+    directPointers = 0;
+    maxFileSize = MAX_FILE_SIZE_INDIRECT;
+  }
+  maxFileBlocks = maxFileSize / UFS_BLOCK_SIZE;
+
+  nextFreeInode = 0;
+  nextFreeData = 0;
+  countFreeSpace();
+
+  inodeVersions = new atomic<unsigned int>[superBlock.num_inodes];
+  for (int i = 0; i < superBlock.num_inodes; i++) {
+    inodeVersions[i] = 0;
+  }
+  dentries = new Dentry[DENTRY_CACHE_ENTRIES];
+  for (int i = 0; i < DENTRY_CACHE_ENTRIES; i++) {
+    dentries[i].sequence = 0;
+    dentries[i].parent = -1;
+  }
+}
+
+LocalFileSystem::~LocalFileSystem() {
+  delete[] inodeVersions;
+  delete[] dentries;
+  pthread_rwlock_destroy(&indexLock);
+  pthread_mutex_destroy(&transactionLock);
+  pthread_cond_destroy(&published);
+  pthread_mutex_destroy(&publishLock);
+}
+
+void LocalFileSystem::countFreeSpace() {
+  vector<unsigned char> inodeBitmap(inodeBitmapSize);
+  vector<unsigned char> dataBitmap(dataBitmapSize);
+  readInodeBitmap(&superBlock, inodeBitmap.data());
+  readDataBitmap(&superBlock, dataBitmap.data());
+
+  freeInodes = countClearBits(inodeBitmap.data(), superBlock.num_inodes);
+  freeDataBlocks = countClearBits(dataBitmap.data(), superBlock.num_data);
+}
+
+void LocalFileSystem::beginTransaction() {
+  pthread_mutex_lock(&transactionLock);
+  disk->beginTransaction();
+  committedFreeInodes = freeInodes;
+  committedFreeDataBlocks = freeDataBlocks;
+}
+
+void LocalFileSystem::commit() {
+  if (!disk->inTransaction()) {
+    return;
+  }
+  disk->commit(publishCommit, this);
+  transactionEntries.clear();
+  transactionInodes.clear();
+  transactionNewBlocks.clear();
+  transactionFreedBlocks.clear();
+  pthread_mutex_unlock(&transactionLock);
+}
+
+void LocalFileSystem::publishCommit(void *arg, bool publishing) {
+  LocalFileSystem *fileSystem = static_cast<LocalFileSystem *>(arg);
+  if (publishing) {
+    fileSystem->beginPublish();
+  } else {
+    fileSystem->endPublish();
+  }
+}
+
+void LocalFileSystem::beginPublish() {
+  // readers of the changed inodes wait from here until everything is
+  // visible, and the ones already reading them will try again
+  for (unsigned int i = 0; i < transactionInodes.size(); i++) {
+    inodeVersions[transactionInodes[i]]++;
+  }
+
+  // bring the shared indexes that show what is being replaced up to date.
+  // Any other index of a changed directory is stale now
+  pthread_rwlock_wrlock(&indexLock);
+  for (unordered_map<int, DirectoryIndex>::iterator pending = transactionEntries.begin();
+       pending != transactionEntries.end(); pending++) {
+    unordered_map<int, VersionedIndex>::iterator index = directoryIndexes.find(pending->first);
+    if (index == directoryIndexes.end() || index->second.version + 1 != inodeVersions[pending->first]) {
+      continue;
+    }
+    for (DirectoryIndex::iterator entry = pending->second.begin(); entry != pending->second.end(); entry++) {
+      if (entry->second == -ENOTFOUND) {
+        index->second.entries.erase(entry->first);
+      } else {
+        index->second.entries[entry->first] = entry->second;
+      }
+    }
+    index->second.version += 2;
+  }
+  pthread_rwlock_unlock(&indexLock);
+}
+
+void LocalFileSystem::endPublish() {
+  for (unsigned int i = 0; i < transactionInodes.size(); i++) {
+    inodeVersions[transactionInodes[i]]++;
+  }
+  // wake the readers that gave up spinning. One that saw a counter odd
+  // checks it again under publishLock before it sleeps, so it can't miss this
+  pthread_mutex_lock(&publishLock);
+  pthread_cond_broadcast(&published);
+  pthread_mutex_unlock(&publishLock);
+}
+
+void LocalFileSystem::rollback() {
+  if (!disk->inTransaction()) {
+    return;
+  }
+  // nobody else saw any of it, only the counters need to go back
+  freeInodes = committedFreeInodes;
+  freeDataBlocks = committedFreeDataBlocks;
+  transactionEntries.clear();
+  transactionInodes.clear();
+  transactionNewBlocks.clear();
+  transactionFreedBlocks.clear();
+  disk->rollback();
+  pthread_mutex_unlock(&transactionLock);
+}
+
+int LocalFileSystem::finishTransaction(int result) {
+  if (result < 0) {
+    rollback();
+  } else {
+    commit();
+  }
+  return result;
+}
+
+unsigned int LocalFileSystem::beginRead(int inodeNumber) {
+  if (inodeNumber < 0 || inodeNumber >= superBlock.num_inodes) {
+    return 0;
+  }
+  unsigned int version = inodeVersions[inodeNumber].load(memory_order_acquire);
+  for (int spins = 0; (version & 1) && spins < PUBLISH_SPINS; spins++) {
+    sched_yield();
+    version = inodeVersions[inodeNumber].load(memory_order_acquire);
+  }
+  if (version & 1) {
+    // an in-place commit flushing the image, sleep until it is done
+    pthread_mutex_lock(&publishLock);
+    version = inodeVersions[inodeNumber].load(memory_order_acquire);
+    while (version & 1) {
+      pthread_cond_wait(&published, &publishLock);
+      version = inodeVersions[inodeNumber].load(memory_order_acquire);
+    }
+    pthread_mutex_unlock(&publishLock);
+  }
+  return version;
+}
+
+bool LocalFileSystem::endRead(int inodeNumber, unsigned int version) {
+  if (inodeNumber < 0 || inodeNumber >= superBlock.num_inodes) {
+    return true;
+  }
+  atomic_thread_fence(memory_order_acquire);
+  return inodeVersions[inodeNumber].load(memory_order_relaxed) == version;
+}
+
+bool LocalFileSystem::changedInTransaction(int inodeNumber) {
+  return disk->inTransaction() &&
+    find(transactionInodes.begin(), transactionInodes.end(), inodeNumber) != transactionInodes.end();
+}
+
+void LocalFileSystem::markChanged(int inodeNumber) {
+  if (inodeNumber >= 0 && inodeNumber < superBlock.num_inodes && !changedInTransaction(inodeNumber)) {
+    transactionInodes.push_back(inodeNumber);
+  }
+}
+
+int LocalFileSystem::findEntry(int inodeNumber, inode_t *inode, const string &name, unsigned int version) {
+  // the transaction's own changes to the directory come first
+  bool changed = changedInTransaction(inodeNumber);
+  if (changed) {
+    unordered_map<int, DirectoryIndex>::iterator pending = transactionEntries.find(inodeNumber);
+    if (pending != transactionEntries.end()) {
+      DirectoryIndex::iterator entry = pending->second.find(name);
+      if (entry != pending->second.end()) {
+        return entry->second;
+      }
+    }
+  }
+
+  pthread_rwlock_rdlock(&indexLock);
+  unordered_map<int, VersionedIndex>::iterator iter = directoryIndexes.find(inodeNumber);
+  if (iter != directoryIndexes.end() && iter->second.version == version) {
+    DirectoryIndex::iterator entry = iter->second.entries.find(name);
+    int result = (entry == iter->second.entries.end()) ? -ENOTFOUND : entry->second;
+    pthread_rwlock_unlock(&indexLock);
+    return result;
+  }
+  pthread_rwlock_unlock(&indexLock);
+
+  // first use of this version of the directory, read it once and hash
+  // every entry. A reader racing a commit can see any size here
+  if (inode->size < 0 || inode->size > maxFileSize) {
+    return -EINVALIDINODE;
+  }
+  vector<char> dirBuffer(inode->size);
+  int bytesRead = readInodeData(inodeNumber, dirBuffer.data(), inode->size, 0);
+  if (bytesRead != inode->size) {
+    return -EINVALIDINODE;
+  }
+
+  DirectoryIndex index;
+  for (int offset = 0; offset + (int) sizeof(dir_ent_t) <= bytesRead; offset += sizeof(dir_ent_t)) {
+    dir_ent_t *entry = reinterpret_cast<dir_ent_t *>(dirBuffer.data() + offset);
+    if (entry->inum != -1) {
+      // insert keeps the first entry with a name, like a linear scan would
+      index.insert(make_pair(string(entry->name, strnlen(entry->name, DIR_ENT_NAME_SIZE)), entry->inum));
+    }
+  }
+  DirectoryIndex::iterator entry = index.find(name);
+  int result = (entry == index.end()) ? -ENOTFOUND : entry->second;
+
+  // share it, unless it has the transaction's changes in it or the
+  // directory has changed since the caller began reading it
+  if (!changed) {
+    pthread_rwlock_wrlock(&indexLock);
+    if (inodeVersions[inodeNumber] == version) {
+      VersionedIndex &shared = directoryIndexes[inodeNumber];
+      shared.version = version;
+      shared.entries = std::move(index);
+    }
+    pthread_rwlock_unlock(&indexLock);
+  }
+  return result;
+}
+
+static int dentrySlot(int parent, const string &name) {
+  return (std::hash<string>()(name) * 31 + parent) % DENTRY_CACHE_ENTRIES;
+}
+
+bool LocalFileSystem::findDentry(int parent, const string &name, unsigned int parentVersion, int *inodeNumber) {
+  // no directory entry has a name this long, create() refuses them
+  if (name.size() >= DIR_ENT_NAME_SIZE) {
+    return false;
+  }
+  Dentry &dentry = dentries[dentrySlot(parent, name)];
+  unsigned int sequence = dentry.sequence.load(memory_order_acquire);
+  if (sequence & 1) {
+    return false;
+  }
+  bool match = dentry.parent == parent && dentry.parentVersion == parentVersion &&
+    strncmp(dentry.name, name.c_str(), DIR_ENT_NAME_SIZE) == 0;
+  int found = dentry.inodeNumber;
+  atomic_thread_fence(memory_order_acquire);
+  if (!match || dentry.sequence.load(memory_order_relaxed) != sequence) {
+    return false;
+  }
+  *inodeNumber = found;
+  return true;
+}
+
+void LocalFileSystem::insertDentry(int parent, const string &name, unsigned int parentVersion, int inodeNumber) {
+  if (name.size() >= DIR_ENT_NAME_SIZE) {
+    return;
+  }
+  Dentry &dentry = dentries[dentrySlot(parent, name)];
+  unsigned int sequence = dentry.sequence.load(memory_order_relaxed);
+  if ((sequence & 1) || !dentry.sequence.compare_exchange_strong(sequence, sequence + 1, memory_order_acq_rel)) {
+    return;
+  }
+  dentry.parent = parent;
+  dentry.parentVersion = parentVersion;
+  dentry.inodeNumber = inodeNumber;
+  memcpy(dentry.name, name.c_str(), name.size());
+  dentry.name[name.size()] = '\0';
+  dentry.sequence.store(sequence + 2, memory_order_release);
+}
+
+int LocalFileSystem::freeInodeCount() {
+  return freeInodes;
+}
+
+int LocalFileSystem::freeDataBlockCount() {
+  return freeDataBlocks;
 }
 
 //good
 void LocalFileSystem::readSuperBlock(super_t *super) {
+  // loaded by the constructor, no need to go to disk again
+  *super = superBlock;
+}
+
+// questionable - test now - old code works for now
+void LocalFileSystem::readInodeBitmap(super_t *super, unsigned char *inodeBitmap) {
+  // the bitmap blocks are adjacent, read them straight into inodeBitmap
+  disk->readBlocks(super->inode_bitmap_addr, super->inode_bitmap_len, inodeBitmap);
+}
+
+void LocalFileSystem::writeInodeBitmap(super_t *super, unsigned char *inodeBitmap) {
+  disk->writeBlocks(super->inode_bitmap_addr, super->inode_bitmap_len, inodeBitmap);
+}
+
+void LocalFileSystem::readDataBitmap(super_t *super, unsigned char *dataBitmap) {
+  disk->readBlocks(super->data_bitmap_addr, super->data_bitmap_len, dataBitmap);
+}
+
+void LocalFileSystem::writeDataBitmap(super_t *super, unsigned char *dataBitmap) {
+  disk->writeBlocks(super->data_bitmap_addr, super->data_bitmap_len, dataBitmap);
+}
+
+void LocalFileSystem::readInodeRegion(super_t *super, inode_t *inodes) {
+  // read 'inode_region_len' blocks from disk into the inodes array
+  disk->readBlocks(super->inode_region_addr, super->inode_region_len, inodes);
+}
+
+void LocalFileSystem::writeInodeRegion(super_t *super, inode_t *inodes) {
+  // Write the inode table back to disk
+  disk->writeBlocks(super->inode_region_addr, super->inode_region_len, inodes);
+}
+
+void LocalFileSystem::readInode(super_t *super, int inodeNumber, inode_t *inode) {
   char block[UFS_BLOCK_SIZE];
 
-  // read block 0 ( this is the superblock)
-  disk->readBlock(0, block);  // removes error check since readBlock returns void
+  // only the block that holds this inode, not the whole table
+  disk->readBlock(super->inode_region_addr + inodeNumber / inodesPerBlock, block);
+  memcpy(inode, block + (inodeNumber % inodesPerBlock) * sizeof(inode_t), sizeof(inode_t));
+}
 
-  // copy the superblock data into the 'super' structure
-  memcpy(super, block, sizeof(super_t));
+void LocalFileSystem::writeInode(super_t *super, int inodeNumber, inode_t *inode) {
+  int blockNum = super->inode_region_addr + inodeNumber / inodesPerBlock;
+  char block[UFS_BLOCK_SIZE];
+
+  // read-modify-write of the one block, the neighbouring inodes stay as they are
+  disk->readBlock(blockNum, block);
+  memcpy(block + (inodeNumber % inodesPerBlock) * sizeof(inode_t), inode, sizeof(inode_t));
+  disk->writeBlock(blockNum, block);
 }
 
-// questionable - test now - old code works for now
-void LocalFileSystem::readInodeBitmap(super_t *super, unsigned char *inodeBitmap) {
-  for (int i = 0; i < super->inode_bitmap_len; i++) {  
-    char block[UFS_BLOCK_SIZE];  
-    int blockNum = super->inode_bitmap_addr + i;  
-    disk->readBlock(blockNum, block);  
+// whether an address from an inode or an indirect block is a data block.
+// Readers racing a commit can come across anything there
+static bool isDataBlock(const super_t &super, unsigned int address) {
+  return address >= (unsigned int) super.data_region_addr &&
+    address < (unsigned int) (super.data_region_addr + super.data_region_len);
+}
 
-    // copy the inode bitmap block into memory  
-    memcpy(reinterpret_cast<char*>(inodeBitmap) + (i * UFS_BLOCK_SIZE), block, UFS_BLOCK_SIZE);  
+int LocalFileSystem::fileBlocks(inode_t *inode, int count, vector<unsigned int> &blocks) {
+  blocks.clear();
+  if (count < 0 || count > maxFileBlocks) {
+    return -1;
+  }
+  blocks.reserve(count);
+
+  if (superBlock.version == UFS_VERSION_EXTENT) {
+    extent_t *extents = reinterpret_cast<extent_t *>(inode->direct);
+    for (int e = 0; e < NUM_EXTENTS && (int) blocks.size() < count; e++) {
+      for (unsigned int i = 0; i < extents[e].length && (int) blocks.size() < count; i++) {
+        blocks.push_back(extents[e].start + i);
+      }
+    }
+    return ((int) blocks.size() == count) ? checkDataBlocks(blocks) : -1;
+  }
+
+  for (int i = 0; i < count && i < directPointers; i++) {
+    blocks.push_back(inode->direct[i]);
+  }
+  if ((int) blocks.size() == count) {
+    return checkDataBlocks(blocks);
+  }
+
+  // only version 1 files get past the direct pointers
+  unsigned int pointers[PTRS_PER_BLOCK];
+  if (!isDataBlock(superBlock, inode->direct[INDIRECT_PTR])) {
+    return -1;
+  }
+  disk->readBlock(inode->direct[INDIRECT_PTR], pointers);
+  for (int i = 0; i < PTRS_PER_BLOCK && (int) blocks.size() < count; i++) {
+    blocks.push_back(pointers[i]);
+  }
+  if ((int) blocks.size() == count) {
+    return checkDataBlocks(blocks);
+  }
+
+  unsigned int indirect[PTRS_PER_BLOCK];
+  if (!isDataBlock(superBlock, inode->direct[DOUBLE_INDIRECT_PTR])) {
+    return -1;
+  }
+  disk->readBlock(inode->direct[DOUBLE_INDIRECT_PTR], indirect);
+
+  // all the second-level blocks this file uses in one vectored read
+  int left = count - blocks.size();
+  int levels = (left + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
+  for (int j = 0; j < levels; j++) {
+    if (!isDataBlock(superBlock, indirect[j])) {
+      return -1;
+    }
+  }
+  vector<unsigned int> levelBlocks(indirect, indirect + levels);
+  vector<unsigned int> second((size_t) levels * PTRS_PER_BLOCK);
+  vector<int> blockNumbers;
+  vector<struct iovec> buffers;
+  blockVector(levelBlocks, levels, reinterpret_cast<unsigned char *>(second.data()), blockNumbers, buffers);
+  disk->readBlocks(levels, blockNumbers.data(), buffers.data());
+  blocks.insert(blocks.end(), second.begin(), second.begin() + left);
+  return checkDataBlocks(blocks);
 }
+
+int LocalFileSystem::checkDataBlocks(const vector<unsigned int> &blocks) {
+  for (unsigned int i = 0; i < blocks.size(); i++) {
+    if (!isDataBlock(superBlock, blocks[i])) {
+      return -1;
+    }
+  }
+  return 0;
 }
 
-void LocalFileSystem::writeInodeBitmap(super_t *super, unsigned char *inodeBitmap) {
-  // write each block of inode bitmap back to disk
-  for (int i = 0; i < super->inode_bitmap_len; i++) {
-      char block[UFS_BLOCK_SIZE];
-      // copy corresponding section of inodeBitmap to block buffer
-      memcpy(block, reinterpret_cast<char*>(inodeBitmap) + (i * UFS_BLOCK_SIZE), UFS_BLOCK_SIZE);
-      // write block to disk
-      int blockNum = super->inode_bitmap_addr + i;
-      disk->writeBlock(blockNum, block);
+// number of indirect and double-indirect blocks a file of `count` blocks needs
+int LocalFileSystem::indirectBlocksFor(int count) {
+  if (superBlock.version != UFS_VERSION_INDIRECT) {
+    return 0;
+  }
+  int blocks = 0;
+  if (count > directPointers) {
+    blocks++;
+  }
+  int doubleStart = directPointers + PTRS_PER_BLOCK;
+  if (count > doubleStart) {
+    blocks += 1 + (count - doubleStart + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
   }
+  return blocks;
 }
 
-void LocalFileSystem::readDataBitmap(super_t *super, unsigned char *dataBitmap) {
-  // read each block of the data bitmap region -> copy into dataBitmap.
-  for (int i = 0; i < super->data_bitmap_len; i++) {
-      char block[UFS_BLOCK_SIZE];
-      int blockNum = super->data_bitmap_addr + i;
-      disk->readBlock(blockNum, block);
-      memcpy(reinterpret_cast<char*>(dataBitmap) + (i * UFS_BLOCK_SIZE), block, UFS_BLOCK_SIZE);
+unsigned int LocalFileSystem::allocateIndirectBlock(unsigned char *dataBitmap) {
+  // resizeFile reserves room for these before it allocates anything
+  int bit = allocateBit(dataBitmap, superBlock.num_data, nextFreeData);
+  assert(bit != -1);
+  nextFreeData = bit + 1;
+  freeDataBlocks--;
+  return bit + superBlock.data_region_addr;
+}
+
+void LocalFileSystem::freeDataBlock(unsigned char *dataBitmap, unsigned int address) {
+  int bit = (int) address - superBlock.data_region_addr;
+  if (bit >= 0 && bit < superBlock.num_data && clearBit(dataBitmap, bit)) {
+    freeDataBlocks++;
+    if (transactionNewBlocks.erase(address) == 0) {
+      transactionFreedBlocks.insert(address);
+    }
   }
 }
 
-void LocalFileSystem::writeDataBitmap(super_t *super, unsigned char *dataBitmap) {
-  // write each block of data bitmap back to disk
-  for (int i = 0; i < super->data_bitmap_len; i++) {
-      char block[UFS_BLOCK_SIZE];
-      // copy corresponding section of dataBitmap to block buffer
-      memcpy(block, reinterpret_cast<char*>(dataBitmap) + (i * UFS_BLOCK_SIZE), UFS_BLOCK_SIZE);
-      // write block to disk
-      int blockNum = super->data_bitmap_addr + i;
-      disk->writeBlock(blockNum, block);
+void LocalFileSystem::writeIndirectBlock(unsigned int address, const vector<unsigned int> &blocks, int first) {
+  unsigned int pointers[PTRS_PER_BLOCK];
+  memset(pointers, 0, sizeof(pointers));
+  for (int i = 0; i < PTRS_PER_BLOCK && first + i < (int) blocks.size(); i++) {
+    pointers[i] = blocks[first + i];
   }
+  disk->writeBlock(address, pointers);
 }
 
-void LocalFileSystem::readInodeRegion(super_t *super, inode_t *inodes) {
-  // read 'inode_region_len' blocks from disk into the inodes array
-  for (int i = 0; i < super->inode_region_len; i++) {
-      char block[UFS_BLOCK_SIZE];
-      int blockNum = super->inode_region_addr + i;  // starting block of inode region + offset
+int LocalFileSystem::resizeFile(inode_t *inode, int count, unsigned char *dataBitmap, vector<unsigned int> &blocks) {
+  int current = (inode->size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+  if (fileBlocks(inode, current, blocks) != 0) {
+    return -1;
+  }
+
+  // when growing, settle for as many blocks as fit along with the indirect
+  // blocks they need. The indirect blocks the file has now are reused
+  if (count > current) {
+    int available = freeDataBlocks + indirectBlocksFor(current);
+    count = min(count, current + freeDataBlocks);
+    while (count > current && (count - current) + indirectBlocksFor(count) > available) {
+      count--;
+    }
+  }
+
+  // free the data blocks past the new end
+  for (int i = count; i < current; i++) {
+    freeDataBlock(dataBitmap, blocks[i]);
+  }
+  if (count < current) {
+    blocks.resize(count);
+  }
+
+  // allocate the missing ones, in as few contiguous runs as possible and
+  // preferably right after the last block the file already has. The first
+  // pass keeps the blocks this transaction freed marked as used, so that
+  // they are only taken when there is nothing else
+  for (int pass = 0; pass < 2 && (int) blocks.size() < count; pass++) {
+    vector<int> hidden;
+    if (pass == 0) {
+      for (unordered_set<unsigned int>::iterator freed = transactionFreedBlocks.begin();
+           freed != transactionFreedBlocks.end(); freed++) {
+        int bit = *freed - superBlock.data_region_addr;
+        if (!(dataBitmap[bit / 8] & (1 << (bit % 8)))) {
+          setBit(dataBitmap, bit);
+          hidden.push_back(bit);
+        }
+      }
+    }
+    while ((int) blocks.size() < count) {
+      int hint = nextFreeData;
+      if (!blocks.empty()) {
+        hint = blocks.back() - superBlock.data_region_addr + 1;
+      }
+      int runLength;
+      int runStart = allocateRun(dataBitmap, superBlock.num_data, hint, count - blocks.size(), &runLength);
+      if (runStart == -1) {
+        break;
+      }
+      for (int j = 0; j < runLength; j++) {
+        unsigned int address = runStart + j + superBlock.data_region_addr;
+        blocks.push_back(address);
+        if (transactionFreedBlocks.erase(address) == 0) {
+          transactionNewBlocks.insert(address);
+        }
+      }
+      nextFreeData = runStart + runLength;
+      freeDataBlocks -= runLength;
+    }
+    for (unsigned int j = 0; j < hidden.size(); j++) {
+      clearBit(dataBitmap, hidden[j]);
+    }
+  }
+  count = blocks.size();
+
+  if (superBlock.version == UFS_VERSION_EXTENT) {
+    return setExtents(inode, dataBitmap, blocks);
+  }
 
-      // read one block from the disk
-      disk->readBlock(blockNum, block);
+  for (int i = 0; i < directPointers; i++) {
+    inode->direct[i] = (i < count) ? blocks[i] : 0;
+  }
+  if (superBlock.version == UFS_VERSION_DIRECT) {
+    return count;
+  }
+
+  // single-indirect block
+  if (count > directPointers) {
+    if (inode->direct[INDIRECT_PTR] == 0) {
+      inode->direct[INDIRECT_PTR] = allocateIndirectBlock(dataBitmap);
+    }
+    writeIndirectBlock(inode->direct[INDIRECT_PTR], blocks, directPointers);
+  } else if (inode->direct[INDIRECT_PTR] != 0) {
+    freeDataBlock(dataBitmap, inode->direct[INDIRECT_PTR]);
+    inode->direct[INDIRECT_PTR] = 0;
+  }
 
-      // copy the block into the correct place in the 'inodes' array yippee
-      memcpy(reinterpret_cast<char*>(inodes) + (i * UFS_BLOCK_SIZE),
-             block,
-             UFS_BLOCK_SIZE);
+  // double-indirect block, keeping the indirect blocks it already points to
+  int doubleStart = directPointers + PTRS_PER_BLOCK;
+  int indirectNeeded = (count > doubleStart) ? (count - doubleStart + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK : 0;
+  if (indirectNeeded == 0 && inode->direct[DOUBLE_INDIRECT_PTR] == 0) {
+    return count;
   }
+
+  unsigned int indirect[PTRS_PER_BLOCK];
+  memset(indirect, 0, sizeof(indirect));
+  if (inode->direct[DOUBLE_INDIRECT_PTR] != 0) {
+    disk->readBlock(inode->direct[DOUBLE_INDIRECT_PTR], indirect);
+  }
+  for (int j = 0; j < PTRS_PER_BLOCK; j++) {
+    if (j < indirectNeeded) {
+      if (indirect[j] == 0) {
+        indirect[j] = allocateIndirectBlock(dataBitmap);
+      }
+      writeIndirectBlock(indirect[j], blocks, doubleStart + j * PTRS_PER_BLOCK);
+    } else if (indirect[j] != 0) {
+      freeDataBlock(dataBitmap, indirect[j]);
+      indirect[j] = 0;
+    }
+  }
+
+  if (indirectNeeded > 0) {
+    if (inode->direct[DOUBLE_INDIRECT_PTR] == 0) {
+      inode->direct[DOUBLE_INDIRECT_PTR] = allocateIndirectBlock(dataBitmap);
+    }
+    disk->writeBlock(inode->direct[DOUBLE_INDIRECT_PTR], indirect);
+  } else {
+    freeDataBlock(dataBitmap, inode->direct[DOUBLE_INDIRECT_PTR]);
+    inode->direct[DOUBLE_INDIRECT_PTR] = 0;
+  }
+  return count;
 }
 
-void LocalFileSystem::writeInodeRegion(super_t *super, inode_t *inodes) {
-  // Write the inode table back to disk
-  for (int i = 0; i < super->inode_region_len; i++) {
-      char block[UFS_BLOCK_SIZE];
-      // Copy the corresponding section of inodes to the block buffer
-      memcpy(block, reinterpret_cast<char*>(inodes) + (i * UFS_BLOCK_SIZE), UFS_BLOCK_SIZE);
-      // Write block to disk
-      int blockNum = super->inode_region_addr + i;
-      disk->writeBlock(blockNum, block);
+int LocalFileSystem::setExtents(inode_t *inode, unsigned char *dataBitmap, vector<unsigned int> &blocks) {
+  extent_t *extents = reinterpret_cast<extent_t *>(inode->direct);
+  memset(inode->direct, 0, sizeof(inode->direct));
+
+  int used = 0;
+  for (int i = 0; i < (int) blocks.size(); i++) {
+    if (used > 0 && extents[used - 1].start + extents[used - 1].length == blocks[i]) {
+      extents[used - 1].length++;
+      continue;
+    }
+    if (used == NUM_EXTENTS) {
+      // out of extents, the file has to end here
+      for (int j = i; j < (int) blocks.size(); j++) {
+        freeDataBlock(dataBitmap, blocks[j]);
+      }
+      blocks.resize(i);
+      break;
+    }
+    extents[used].start = blocks[i];
+    extents[used].length = 1;
+    used++;
   }
+  return blocks.size();
 }
 
 // rm error and mkdir/touch func point testing - new function - its helping - DIAGNOSED AS PART OF ISSUE
 int LocalFileSystem::lookup(int parentInodeNumber, string targetName) {
+    while (true) {
+        unsigned int version = beginRead(parentInodeNumber);
+        int result = lookupEntry(parentInodeNumber, targetName, version);
+        if (endRead(parentInodeNumber, version)) {
+            return result;
+        }
+    }
+}
+
+int LocalFileSystem::lookupEntry(int parentInodeNumber, const string &targetName, unsigned int version) {
+    // answered before for this version of the parent, found or not. Not
+    // for a directory the transaction changed, it sees its own version
+    bool changed = changedInTransaction(parentInodeNumber);
+    int result;
+    if (!changed && findDentry(parentInodeNumber, targetName, version, &result)) {
+        return result;
+    }
+
     inode_t parentDirInode;
 
     // get the parent directory's inode
-    int status = this->stat(parentInodeNumber, &parentDirInode);
+    int status = statInode(parentInodeNumber, &parentDirInode);
     if (status != 0) {
         return -EINVALIDINODE;
     }
@@ -114,91 +812,130 @@ int LocalFileSystem::lookup(int parentInodeNumber, string targetName) {
         return -EINVALIDINODE;
     }
 
-    int dirSize = parentDirInode.size;
-    vector<char> dirBuffer(dirSize);
-
-    // read directory data into buffer
-    int bytesRead = this->read(parentInodeNumber, dirBuffer.data(), dirSize);
-    if (bytesRead < 0) {
-        return -EINVALIDINODE;
+    // find the entry in the directory's hashed index
+    result = findEntry(parentInodeNumber, &parentDirInode, targetName, version);
+    if (result == -EINVALIDINODE) {
+        return result;
     }
 
-    int offset = 0;
-    while (offset < bytesRead) {
-        dir_ent_t *entry = reinterpret_cast<dir_ent_t *>(dirBuffer.data() + offset);
-
-        // check if the entry is valid and matches the target name
-        if (entry->inum != -1 && strcmp(entry->name, targetName.c_str()) == 0) {
-            return entry->inum;
-        }
-
-        offset += sizeof(dir_ent_t);
+    // remember the answer, misses included. Only names in valid directories
+    // get here, so the cache never holds an -EINVALIDINODE. What a reader
+    // racing a commit found is remembered under a version nobody matches
+    if (!changed) {
+        insertDentry(parentInodeNumber, targetName, version, result);
     }
-
-    return -ENOTFOUND;  // entry not found
+    return result;
 }
 
-// questionable - test now - old code works for now
 int LocalFileSystem::stat(int inodeNumber, inode_t *inode) {
-    super_t super;
-    readSuperBlock(&super); // read the superblock to get inode region details
+    while (true) {
+        unsigned int version = beginRead(inodeNumber);
+        int result = statInode(inodeNumber, inode);
+        if (endRead(inodeNumber, version)) {
+            return result;
+        }
+    }
+}
 
+int LocalFileSystem::statInode(int inodeNumber, inode_t *inode) {
     // check if the inode number is within a valid range
-    if (inodeNumber < 0 || inodeNumber >= super.num_inodes) {
+    if (inodeNumber < 0 || inodeNumber >= superBlock.num_inodes) {
         return -1; // invalid inode number
     }
 
-    // calculate the total number of inodes in the inode region
-    int numInodesInRegion = (super.inode_region_len * UFS_BLOCK_SIZE) / sizeof(inode_t);
-    if (inodeNumber >= numInodesInRegion) {
+    // check against the number of inodes that fit in the inode region
+    if (inodeNumber >= inodeRegionCapacity) {
         return -1; // inode number is out of bounds
     }
 
-    // read the entire inode table into memory
-    vector<inode_t> inodes(numInodesInRegion);
-    readInodeRegion(&super, inodes.data());
-
-    // copy the requested inode data into the provided structure
-    *inode = inodes[inodeNumber];
+    // read just the block holding the requested inode
+    readInode(&superBlock, inodeNumber, inode);
     return 0;
 }
 
 // questionable - test now - diagnosed as the issue for my read utility tests - fixed
 int LocalFileSystem::read(int inodeNumber, void *buffer, int size) {
+    return read(inodeNumber, buffer, size, 0);
+}
+
+int LocalFileSystem::read(int inodeNumber, void *buffer, int size, int offset) {
+    while (true) {
+        unsigned int version = beginRead(inodeNumber);
+        int result = readInodeData(inodeNumber, buffer, size, offset);
+        if (endRead(inodeNumber, version)) {
+            return result;
+        }
+    }
+}
+
+int LocalFileSystem::readInodeData(int inodeNumber, void *buffer, int size, int offset) {
     inode_t inode;
     // retrieve inode information
-    int statResult = stat(inodeNumber, &inode);
+    int statResult = statInode(inodeNumber, &inode);
     if (statResult != 0) {
         return statResult; // return error if inode lookup fails
     }
 
-    // check if requested size is valid
-    if (size > MAX_FILE_SIZE || size < 0) {
+    // check if requested size and offset are valid
+    if (size > maxFileSize || size < 0 || offset < 0) {
         return -EINVALIDSIZE; // invalid file size
     }
 
-    // if requested size is larger than the actual file size, adjust it
-    if (size > inode.size) {
-        size = inode.size;
+    // nothing past the end of the file, and no more than is left of it
+    if (offset >= inode.size) {
+        return 0;
+    }
+    if (size > inode.size - offset) {
+        size = inode.size - offset;
+    }
+    if (size == 0) {
+        return 0;
     }
 
-    int total_bytes_read = 0;
-    char* bufferPtr = static_cast<char*>(buffer);
-
-    // calculate number of blocks needed to read the requested size
-    int num_blocks = (size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
-    for (int i = 0; i < num_blocks; i++) {
-        char buf[UFS_BLOCK_SIZE];
-
-        // read the corresponding block from disk
-        disk->readBlock(inode.direct[i], buf);
+    // only the blocks that hold [offset, offset + size)
+    int end = offset + size;
+    int first_block = offset / UFS_BLOCK_SIZE;
+    int end_block = (end + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+    vector<unsigned int> blocks;
+    if (fileBlocks(&inode, end_block, blocks) != 0) {
+        return -EINVALIDINODE;
+    }
 
-        // determine how many bytes to read from this block
-        int bytes_to_read = min(size - total_bytes_read, UFS_BLOCK_SIZE);
+    // whole blocks go straight into the caller's buffer and the partial
+    // ones at either end through partial[], all in one vectored disk read.
+    // mmapped disks let us copy the partial ones straight out of the image
+    char* bufferPtr = static_cast<char*>(buffer);
+    vector<int> blockNumbers;
+    vector<struct iovec> buffers;
+    char partial[2][UFS_BLOCK_SIZE];
+    const char *partialData[2];
+    int partialStart[2];
+    int partialEnd[2];
+    int partials = 0;
+    for (int b = first_block; b < end_block; b++) {
+        int blockStart = b * UFS_BLOCK_SIZE;
+        int from = max(offset, blockStart);
+        int to = min(end, blockStart + UFS_BLOCK_SIZE);
+        if (to - from == UFS_BLOCK_SIZE) {
+            blockNumbers.push_back(blocks[b]);
+            buffers.push_back({bufferPtr + (from - offset), UFS_BLOCK_SIZE});
+            continue;
+        }
 
-        // copy the data into the provided buffer
-        memcpy(bufferPtr + total_bytes_read, buf, bytes_to_read);
-        total_bytes_read += bytes_to_read;
+        const char *block = reinterpret_cast<const char*>(disk->peekBlock(blocks[b]));
+        if (block == NULL) {
+            blockNumbers.push_back(blocks[b]);
+            buffers.push_back({partial[partials], UFS_BLOCK_SIZE});
+            block = partial[partials];
+        }
+        partialData[partials] = block + (from - blockStart);
+        partialStart[partials] = from;
+        partialEnd[partials] = to;
+        partials++;
+    }
+    disk->readBlocks(blockNumbers.size(), blockNumbers.data(), buffers.data());
+    for (int i = 0; i < partials; i++) {
+        memcpy(bufferPtr + (partialStart[i] - offset), partialData[i], partialEnd[i] - partialStart[i]);
     }
 
     // return the total number of bytes read
@@ -207,8 +944,10 @@ int LocalFileSystem::read(int inodeNumber, void *buffer, int size) {
 
 // rm error and mkdir/touch func point testing - new function - its helping
 int LocalFileSystem::create(int parentInodeNumber, int type, string name) {
-    super_t super;
-    readSuperBlock(&super);
+    if (!disk->inTransaction()) {
+        beginTransaction();
+        return finishTransaction(create(parentInodeNumber, type, name));
+    }
 
     // validate filename length
     if (name.empty() || name.size() >= DIR_ENT_NAME_SIZE) {
@@ -227,40 +966,28 @@ int LocalFileSystem::create(int parentInodeNumber, int type, string name) {
     }
 
     // check if parent inode number is valid
-    if (parentInodeNumber < 0 || parentInodeNumber >= super.num_inodes) {
-        return -EINVALIDINODE;
-    }
-
-    // read directory entries from parent inode
-    int totalEntries = parentInode.size / sizeof(dir_ent_t);
-    dir_ent_t dirEntries[totalEntries];
-    if (this->read(parentInodeNumber, dirEntries, parentInode.size) != parentInode.size) {
+    if (parentInodeNumber < 0 || parentInodeNumber >= superBlock.num_inodes) {
         return -EINVALIDINODE;
     }
 
     // check if file/directory already exists
-    for (int i = 0; i < totalEntries; i++) {
-        dir_ent_t entry = dirEntries[i];
-        if (entry.name == name) {
-            inode_t existingInode;
-            stat(entry.inum, &existingInode);
-            return (existingInode.type == type) ? entry.inum : -EINVALIDTYPE;
-        }
+    int existing = findEntry(parentInodeNumber, &parentInode, name, beginRead(parentInodeNumber));
+    if (existing == -EINVALIDINODE) {
+        return existing;
+    }
+    if (existing >= 0) {
+        inode_t existingInode;
+        stat(existing, &existingInode);
+        return (existingInode.type == type) ? existing : -EINVALIDTYPE;
     }
 
+    // the parent gets a new entry. Transactions run one at a time, so it
+    // cannot have appeared since we looked
+    markChanged(parentInodeNumber);
+
     // check for available disk space
     bool hasEnoughSpace = false;
-    int freeBlocks = 0;
-    vector<unsigned char> dataBitmap(super.data_bitmap_len * UFS_BLOCK_SIZE);
-    readDataBitmap(&super, dataBitmap.data());
-
-    for (int i = 0; i < super.num_data; ++i) {
-        int byteIdx = i / 8;
-        int bitIdx = i % 8;
-        if (!(dataBitmap[byteIdx] & (1 << bitIdx))) {
-            freeBlocks++;
-        }
-    }
+    int freeBlocks = freeDataBlockCount();
 
     // determine if additional space is needed
     if ((parentInode.size % UFS_BLOCK_SIZE) == 0) {
@@ -269,27 +996,26 @@ int LocalFileSystem::create(int parentInodeNumber, int type, string name) {
         hasEnoughSpace = (freeBlocks >= 1);
     }
 
-    if (!hasEnoughSpace) {
+    if (!hasEnoughSpace || freeInodeCount() == 0) {
         return -ENOTENOUGHSPACE;
     }
 
+    vector<unsigned char> dataBitmap(dataBitmapSize);
+    readDataBitmap(&superBlock, dataBitmap.data());
+
     // locate a free inode
-    int inodeBitmapSize = super.inode_bitmap_len * UFS_BLOCK_SIZE;
     vector<unsigned char> inodeBitmap(inodeBitmapSize);
-    readInodeBitmap(&super, inodeBitmap.data());
-
-    int newInodeNum = -1;
-    for (int i = 0; i < super.num_inodes; i++) {
-        if (!(inodeBitmap[i / 8] & (1 << (i % 8)))) {
-            inodeBitmap[i / 8] |= (1 << (i % 8));
-            newInodeNum = i;
-            break;
-        }
-    }
+    readInodeBitmap(&superBlock, inodeBitmap.data());
 
+    int newInodeNum = allocateBit(inodeBitmap.data(), superBlock.num_inodes, nextFreeInode);
     if (newInodeNum == -1) {
         return -ENOTENOUGHSPACE;
     }
+    nextFreeInode = newInodeNum + 1;
+    freeInodes--;
+    // nobody can reach it yet, but a reader that looked it up before it
+    // was freed might still be reading it
+    markChanged(newInodeNum);
 
     // initialize new inode
     inode_t newInode;
@@ -300,21 +1026,20 @@ int LocalFileSystem::create(int parentInodeNumber, int type, string name) {
     // allocate block if it's a directory
     int newBlockNum = -1;
     if (type == UFS_DIRECTORY) {
-        for (int i = 0; i < super.num_data; ++i) {
-            if (!(dataBitmap[i / 8] & (1 << (i % 8)))) {
-                newBlockNum = i;
-                dataBitmap[i / 8] |= (1 << (i % 8));
-                break;
-            }
-        }
-
+        newBlockNum = allocateBit(dataBitmap.data(), superBlock.num_data, nextFreeData);
         if (newBlockNum == -1) {
-            inodeBitmap[newInodeNum / 8] &= ~(1 << (newInodeNum % 8));
-            writeInodeBitmap(&super, inodeBitmap.data());
+            clearBit(inodeBitmap.data(), newInodeNum);
+            freeInodes++;
+            writeInodeBitmap(&superBlock, inodeBitmap.data());
             return -ENOTENOUGHSPACE;
         }
+        nextFreeData = newBlockNum + 1;
+        freeDataBlocks--;
 
-        newInode.direct[0] = super.data_region_addr + newBlockNum;
+        newInode.direct[0] = superBlock.data_region_addr + newBlockNum;
+        if (superBlock.version == UFS_VERSION_EXTENT) {
+            newInode.direct[1] = 1; // the extent is just that block
+        }
         
         // create "." and ".." directory entries
         dir_ent_t initEntries[2];
@@ -327,14 +1052,11 @@ int LocalFileSystem::create(int parentInodeNumber, int type, string name) {
 
         disk->writeBlock(newInode.direct[0], initEntries);
         newInode.size = sizeof(initEntries);
-        writeDataBitmap(&super, dataBitmap.data());
+        writeDataBitmap(&superBlock, dataBitmap.data());
     }
 
-    // update inode region
-    vector<inode_t> inodeTable(super.num_inodes);
-    readInodeRegion(&super, inodeTable.data());
-    inodeTable[newInodeNum] = newInode;
-    writeInodeRegion(&super, inodeTable.data());
+    // write the new inode
+    writeInode(&superBlock, newInodeNum, &newInode);
 
     // create new directory entry
     dir_ent_t newEntry;
@@ -343,177 +1065,265 @@ int LocalFileSystem::create(int parentInodeNumber, int type, string name) {
     strncpy(newEntry.name, name.c_str(), DIR_ENT_NAME_SIZE);
     newEntry.inum = newInodeNum;
 
-    // read and update parent directory data
-    vector<char> parentBuffer(parentInode.size + UFS_BLOCK_SIZE - 1, 0);
-    if (this->read(parentInodeNumber, parentBuffer.data(), parentInode.size) != parentInode.size) {
-        inodeBitmap[newInodeNum / 8] &= ~(1 << (newInodeNum % 8));
-        writeInodeBitmap(&super, inodeBitmap.data());
-        return -EINVALIDINODE;
-    }
-
-    // allocate a new block if parent directory is full
-    if (parentInode.size == UFS_BLOCK_SIZE) { 
-        int parentNewBlockIdx = -1;
-        for (int i = 0; i < super.num_data; ++i) {
-            if (!(dataBitmap[i / 8] & (1 << (i % 8)))) {
-                parentNewBlockIdx = i;
-                dataBitmap[i / 8] |= (1 << (i % 8));
-                break;
-            }
-        }
-
-        if (parentNewBlockIdx == -1) {
-            inodeBitmap[newInodeNum / 8] &= ~(1 << (newInodeNum % 8));
-            writeInodeBitmap(&super, inodeBitmap.data());
-            return -ENOTENOUGHSPACE;
-        }
-
-        for (int i = 0; i < DIRECT_PTRS; ++i) {
-            if (parentInode.direct[i] == 0) {
-                parentInode.direct[i] = super.data_region_addr + parentNewBlockIdx;
-                break;
-            }
-        }
-
-        writeDataBitmap(&super, dataBitmap.data());
-    }
-
-    // append new entry to parent directory
-    memcpy(parentBuffer.data() + parentInode.size, &newEntry, sizeof(dir_ent_t));
-    parentInode.size += sizeof(dir_ent_t);
-
-    // update parent inode type and write back
-    inodeTable[parentInodeNumber].type = UFS_REGULAR_FILE;
-    writeInodeRegion(&super, inodeTable.data());
+    // update parent inode type so that write() takes it
+    inode_t parentOnDisk;
+    readInode(&superBlock, parentInodeNumber, &parentOnDisk);
+    parentOnDisk.type = UFS_REGULAR_FILE;
+    writeInode(&superBlock, parentInodeNumber, &parentOnDisk);
 
-    if (this->write(parentInodeNumber, parentBuffer.data(), parentInode.size) != parentInode.size) {
-        inodeBitmap[newInodeNum / 8] &= ~(1 << (newInodeNum % 8));
-        writeInodeBitmap(&super, inodeBitmap.data());
+    // append the new entry, only the parent's last block is written
+    if (this->write(parentInodeNumber, &newEntry, sizeof(dir_ent_t), parentInode.size) != sizeof(dir_ent_t)) {
+        clearBit(inodeBitmap.data(), newInodeNum);
+        freeInodes++;
+        writeInodeBitmap(&superBlock, inodeBitmap.data());
 
         if (type == UFS_DIRECTORY) {
-            int blockIdx = (newInode.direct[0] - super.data_region_addr) / UFS_BLOCK_SIZE;
-            dataBitmap[blockIdx] &= ~(1 << ((newInode.direct[0] - super.data_region_addr) % UFS_BLOCK_SIZE));
-            writeDataBitmap(&super, dataBitmap.data());
+            if (clearBit(dataBitmap.data(), newInode.direct[0] - superBlock.data_region_addr)) {
+                freeDataBlocks++;
+            }
+            writeDataBitmap(&superBlock, dataBitmap.data());
         }
 
-        inodeTable[parentInodeNumber].type = UFS_DIRECTORY;
-        writeInodeRegion(&super, inodeTable.data());
+        parentOnDisk.type = UFS_DIRECTORY;
+        writeInode(&superBlock, parentInodeNumber, &parentOnDisk);
 
         return -ENOTENOUGHSPACE;
     }
 
-    // finalize inode updates
-    writeInodeBitmap(&super, inodeBitmap.data());
-    readInodeRegion(&super, inodeTable.data());
-    inodeTable[parentInodeNumber] = parentInode;
-    writeInodeRegion(&super, inodeTable.data());
+    // finalize inode updates. write() grew the parent's block map if it
+    // had to, so keep that and just turn it back into a directory
+    writeInodeBitmap(&superBlock, inodeBitmap.data());
+    readInode(&superBlock, parentInodeNumber, &parentOnDisk);
+    parentOnDisk.type = UFS_DIRECTORY;
+    writeInode(&superBlock, parentInodeNumber, &parentOnDisk);
+    transactionEntries[parentInodeNumber][name] = newInodeNum;
 
     return newInodeNum;
 }
 
 int LocalFileSystem::write(int inodeNumber, const void *buffer, int size) {
+    if (!disk->inTransaction()) {
+        beginTransaction();
+        return finishTransaction(write(inodeNumber, buffer, size));
+    }
+    markChanged(inodeNumber);
+
+    // replacing the contents is dropping what is past the new end and
+    // writing the rest in place
+    inode_t inode;
+    if (stat(inodeNumber, &inode) < 0) {
+        return -EINVALIDINODE; // file doesn't exist
+    }
+    if (size >= 0 && size < inode.size) {
+        int truncateResult = truncate(inodeNumber, size);
+        if (truncateResult < 0) {
+            return truncateResult;
+        }
+    }
+    return write(inodeNumber, buffer, size, 0);
+}
+
+int LocalFileSystem::write(int inodeNumber, const void *buffer, int size, int offset) {
+    if (!disk->inTransaction()) {
+        beginTransaction();
+        return finishTransaction(write(inodeNumber, buffer, size, offset));
+    }
+    markChanged(inodeNumber);
+
     // get the inode for the given file
     inode_t inode;
     if (stat(inodeNumber, &inode) < 0) {
-        return -1; // file doesn't exist
+        return -EINVALIDINODE; // file doesn't exist
     }
 
     // make sure it's a regular file (not a directory)
     if (inode.type != UFS_REGULAR_FILE) {
-        return -1; // cannot write to non-regular files
+        return -EINVALIDTYPE; // cannot write to non-regular files
     }
 
-    // read the superblock, which contains filesystem metadata
-    super_t super;
-    readSuperBlock(&super);
-
-    // figure out how many blocks are needed for the new data
-    int blocksNeeded = (size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE; // round up
-    if (blocksNeeded > DIRECT_PTRS) {
-        blocksNeeded = DIRECT_PTRS; // limit to max direct pointers
-        size = DIRECT_PTRS * UFS_BLOCK_SIZE; // adjust size accordingly
+    if (size < 0 || offset < 0 || offset > maxFileSize) {
+        return -EINVALIDSIZE;
     }
 
-    // load the data bitmap, which tracks free and used blocks
-    int dataBitmapSize = super.data_bitmap_len * UFS_BLOCK_SIZE;
-    vector<unsigned char> dataBitmap(dataBitmapSize);
-    readDataBitmap(&super, dataBitmap.data());
-
-    // count how many blocks are already allocated to this file
-    int currentBlocks = 0;
-    for (int i = 0; i < DIRECT_PTRS; i++) {
-        if (inode.direct[i] != 0) {
-            currentBlocks++;
-        }
+    // limit the write to what the block map can address
+    if (size > maxFileSize - offset) {
+        size = maxFileSize - offset;
     }
-
-    // allocate additional blocks if needed
-    for (int i = currentBlocks; i < blocksNeeded; i++) {
-        int newBlock = -1;
-        // find a free block in the data region
-        for (int j = 0; j < super.num_data; j++) {
-            int byteIndex = j / 8;
-            int bitIndex = j % 8;
-            if ((dataBitmap[byteIndex] & (1 << bitIndex)) == 0) {
-                newBlock = j;
-                // mark it as used
-                dataBitmap[byteIndex] |= (1 << bitIndex);
-                break;
-            }
+    int end = offset + size;
+    int newSize = max(inode.size, end);
+    int currentBlocks = (inode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+    int blocksNeeded = (newSize + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE; // round up
+
+    // only a file that grows needs the data bitmap, otherwise just look up
+    // the blocks it already has
+    vector<unsigned char> dataBitmap;
+    vector<unsigned int> blocks;
+    if (blocksNeeded > currentBlocks) {
+        dataBitmap.resize(dataBitmapSize);
+        readDataBitmap(&superBlock, dataBitmap.data());
+        int blocksAllocated = resizeFile(&inode, blocksNeeded, dataBitmap.data(), blocks);
+        if (blocksAllocated < 0) {
+            return -EINVALIDINODE; // damaged block map
         }
-        if (newBlock == -1) {
-            // no free blocks left, adjust file size to fit available space
-            blocksNeeded = i;
-            size = i * UFS_BLOCK_SIZE;
-            break;
+        if (blocksAllocated < blocksNeeded) {
+            // no free blocks left, the file ends where the space does
+            blocksNeeded = blocksAllocated;
+            newSize = blocksAllocated * UFS_BLOCK_SIZE;
+            end = max(offset, min(end, newSize));
         }
-        inode.direct[i] = newBlock + super.data_region_addr;
+    } else if (fileBlocks(&inode, blocksNeeded, blocks) != 0) {
+        return -EINVALIDINODE;
     }
 
-    // free up blocks if the file now needs fewer than before
-    for (int i = blocksNeeded; i < currentBlocks; i++) {
-        if (inode.direct[i] != 0) {
-            int dataBlockNum = inode.direct[i] - super.data_region_addr;
-            int byteIndex = dataBlockNum / 8;
-            int bitIndex = dataBlockNum % 8;
-            dataBitmap[byteIndex] &= ~(1 << bitIndex); // mark block as free
-            inode.direct[i] = 0;
+    // the blocks the data lands in, plus new blocks in front of it that
+    // have to be zeroed because they may still hold a freed file's data.
+    // That is never more than the file has: on a full disk a write that
+    // starts past the space it got writes nothing and only grows the file
+    int firstBlock = min(offset / UFS_BLOCK_SIZE, currentBlocks);
+    int endBlock = blocksNeeded;
+
+    // whole blocks are written straight from the caller's buffer and the
+    // partial ones at either end through partial[], after reading what
+    // the file already had there. All of it is one vectored disk write
+    const char* bufPtr = static_cast<const char*>(buffer);
+    vector<int> blockNumbers;
+    vector<struct iovec> buffers;
+    vector<int> readNumbers;
+    vector<struct iovec> readBuffers;
+    char partial[2][UFS_BLOCK_SIZE];
+    char zeroBlock[UFS_BLOCK_SIZE];
+    memset(zeroBlock, 0, UFS_BLOCK_SIZE);
+    int partialOffset[2];
+    int partialStart[2];
+    int partialEnd[2];
+    int partials = 0;
+    for (int b = firstBlock; b < endBlock; b++) {
+        int blockStart = b * UFS_BLOCK_SIZE;
+        int from = max(offset, blockStart);
+        int to = min(end, blockStart + UFS_BLOCK_SIZE);
+        bool fresh = (b >= currentBlocks);
+        if (to - from == UFS_BLOCK_SIZE) {
+            blockNumbers.push_back(blocks[b]);
+            buffers.push_back({(char *) bufPtr + (from - offset), UFS_BLOCK_SIZE});
+        } else if (to > from) {
+            if (fresh) {
+                memset(partial[partials], 0, UFS_BLOCK_SIZE);
+            } else {
+                readNumbers.push_back(blocks[b]);
+                readBuffers.push_back({partial[partials], UFS_BLOCK_SIZE});
+            }
+            blockNumbers.push_back(blocks[b]);
+            buffers.push_back({partial[partials], UFS_BLOCK_SIZE});
+            partialOffset[partials] = from - blockStart;
+            partialStart[partials] = from;
+            partialEnd[partials] = to;
+            partials++;
+        } else if (fresh) {
+            blockNumbers.push_back(blocks[b]);
+            buffers.push_back({zeroBlock, UFS_BLOCK_SIZE});
         }
     }
+    disk->readBlocks(readNumbers.size(), readNumbers.data(), readBuffers.data());
+    for (int i = 0; i < partials; i++) {
+        memcpy(partial[i] + partialOffset[i], bufPtr + (partialStart[i] - offset), partialEnd[i] - partialStart[i]);
+    }
 
-    // write the file data to allocated blocks
-    int bytesWritten = 0;
-    const char* bufPtr = static_cast<const char*>(buffer);
-    char block[UFS_BLOCK_SIZE];
-    for (int i = 0; i < blocksNeeded && bytesWritten < size; i++) {
-        int bytesToWrite = std::min(UFS_BLOCK_SIZE, size - bytesWritten);
-        memset(block, 0, UFS_BLOCK_SIZE); // clear the block before writing
-        memcpy(block, bufPtr + bytesWritten, bytesToWrite);
-        disk->writeBlock(inode.direct[i], block);
-        bytesWritten += bytesToWrite;
+    // blocks that were free when the transaction began go straight to the
+    // image, so that a large write does not pile up in the transaction
+    vector<int> newNumbers;
+    vector<struct iovec> newBuffers;
+    int kept = 0;
+    for (unsigned int i = 0; i < blockNumbers.size(); i++) {
+        if (transactionNewBlocks.count(blockNumbers[i]) > 0) {
+            newNumbers.push_back(blockNumbers[i]);
+            newBuffers.push_back(buffers[i]);
+        } else {
+            blockNumbers[kept] = blockNumbers[i];
+            buffers[kept] = buffers[i];
+            kept++;
+        }
     }
+    disk->writeNewBlocks(newNumbers.size(), newNumbers.data(), newBuffers.data());
+    disk->writeBlocks(kept, blockNumbers.data(), buffers.data());
 
     // update the inode with the new file size
-    inode.size = size;
+    inode.size = newSize;
 
-    // update the inode table on disk
-    int numInodesInRegion = (super.inode_region_len * UFS_BLOCK_SIZE) / sizeof(inode_t);
-    vector<inode_t> inodes(numInodesInRegion);
-    readInodeRegion(&super, inodes.data());
-    inodes[inodeNumber] = inode;
-    writeInodeRegion(&super, inodes.data());
+    // update the inode on disk
+    writeInode(&superBlock, inodeNumber, &inode);
 
     // save the updated data bitmap back to disk
-    writeDataBitmap(&super, dataBitmap.data());
+    if (!dataBitmap.empty()) {
+        writeDataBitmap(&superBlock, dataBitmap.data());
+    }
 
-    return bytesWritten;
+    return end - offset;
+}
+
+int LocalFileSystem::truncate(int inodeNumber, int size) {
+    if (!disk->inTransaction()) {
+        beginTransaction();
+        return finishTransaction(truncate(inodeNumber, size));
+    }
+    markChanged(inodeNumber);
+
+    inode_t inode;
+    if (stat(inodeNumber, &inode) < 0) {
+        return -EINVALIDINODE;
+    }
+    if (inode.type != UFS_REGULAR_FILE) {
+        return -EINVALIDTYPE;
+    }
+    if (size < 0 || size > maxFileSize) {
+        return -EINVALIDSIZE;
+    }
+
+    // growing is an empty write at the new end, which zero-fills the blocks
+    // in between
+    if (size > inode.size) {
+        int writeResult = write(inodeNumber, NULL, 0, size);
+        if (writeResult < 0) {
+            return writeResult;
+        }
+        stat(inodeNumber, &inode);
+        return (inode.size == size) ? 0 : -ENOTENOUGHSPACE;
+    }
+    if (size == inode.size) {
+        return 0;
+    }
+
+    // free the blocks past the new end
+    vector<unsigned char> dataBitmap(dataBitmapSize);
+    readDataBitmap(&superBlock, dataBitmap.data());
+    vector<unsigned int> blocks;
+    int count = (size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+    if (resizeFile(&inode, count, dataBitmap.data(), blocks) < 0) {
+        return -EINVALIDINODE;
+    }
+
+    // zero what is left of the last block past the new end, so that bytes
+    // past the end of a file always read as zero when it grows again
+    if (size % UFS_BLOCK_SIZE != 0) {
+        char block[UFS_BLOCK_SIZE];
+        disk->readBlock(blocks[count - 1], block);
+        memset(block + size % UFS_BLOCK_SIZE, 0, UFS_BLOCK_SIZE - size % UFS_BLOCK_SIZE);
+        disk->writeBlock(blocks[count - 1], block);
+    }
+
+    inode.size = size;
+    writeInode(&superBlock, inodeNumber, &inode);
+    writeDataBitmap(&superBlock, dataBitmap.data());
+    return 0;
 }
 
 // rm error and mkdir/touch func point testing - new function - its helping
 int LocalFileSystem::unlink(int parentInodeNumber, string name) {
-    super_t super;
+    if (!disk->inTransaction()) {
+        beginTransaction();
+        return finishTransaction(unlink(parentInodeNumber, name));
+    }
+
     inode_t parent_inode;
-    readSuperBlock(&super);
 
     // check if the parent inode exists and is a directory
     if (stat(parentInodeNumber, &parent_inode) != 0 || parent_inode.type != UFS_DIRECTORY) {
@@ -529,8 +1339,8 @@ int LocalFileSystem::unlink(int parentInodeNumber, string name) {
     }
 
     // read the inode bitmap to verify the parent inode is valid
-    unsigned char inode_bitmap[super.inode_bitmap_len * UFS_BLOCK_SIZE];
-    readInodeBitmap(&super, inode_bitmap);
+    unsigned char inode_bitmap[inodeBitmapSize];
+    readInodeBitmap(&superBlock, inode_bitmap);
 
     if ((inode_bitmap[parentInodeNumber / 8] & (1 << (parentInodeNumber % 8))) == 0) {
         return -EINVALIDINODE;
@@ -542,6 +1352,8 @@ int LocalFileSystem::unlink(int parentInodeNumber, string name) {
     if (target_inode_num == -ENOTFOUND) {
         return 0; // file doesn't exist, nothing to delete
     }
+    markChanged(parentInodeNumber);
+    markChanged(target_inode_num);
 
     stat(target_inode_num, &target_inode);
 
@@ -553,22 +1365,24 @@ int LocalFileSystem::unlink(int parentInodeNumber, string name) {
     }
 
     // mark the inode as free in the bitmap
-    inode_bitmap[target_inode_num / 8] &= ~(1 << (target_inode_num % 8));
-    writeInodeBitmap(&super, inode_bitmap);
+    if (clearBit(inode_bitmap, target_inode_num)) {
+        freeInodes++;
+    }
+    writeInodeBitmap(&superBlock, inode_bitmap);
 
     // read the data block bitmap
-    unsigned char data_bitmap[super.data_bitmap_len * UFS_BLOCK_SIZE];
-    readDataBitmap(&super, data_bitmap);
+    unsigned char data_bitmap[dataBitmapSize];
+    readDataBitmap(&superBlock, data_bitmap);
 
-    // free all blocks allocated to the file
-    int total_blocks = target_inode.size / UFS_BLOCK_SIZE;
-    if (target_inode.size % UFS_BLOCK_SIZE != 0) {
-        total_blocks++;
-    }
-    for (int i = 0; i < total_blocks; i++) {
-        data_bitmap[target_inode.direct[i] / 8] &= ~(1 << (target_inode.direct[i] % 8));
-    }
-    writeDataBitmap(&super, data_bitmap);
+    // free all blocks allocated to the file, indirect blocks included
+    vector<unsigned int> target_blocks;
+    resizeFile(&target_inode, 0, data_bitmap, target_blocks);
+    writeDataBitmap(&superBlock, data_bitmap);
+
+    // the freed inode must not point at blocks other files get next. A
+    // reader that looked it up before it went reads an empty file
+    target_inode.size = 0;
+    writeInode(&superBlock, target_inode_num, &target_inode);
 
     // load the parent directory entries
     vector<dir_ent_t> dir_entries(parent_inode.size / sizeof(dir_ent_t));
@@ -583,22 +1397,30 @@ int LocalFileSystem::unlink(int parentInodeNumber, string name) {
         }
     }
 
-    // write the updated directory entries back to disk
-    unsigned char *buf_ptr = reinterpret_cast<unsigned char *>(dir_entries.data());
-    for (int i = 0, remaining_size = parent_inode.size; remaining_size > 0; i++) {
-        disk->writeBlock(parent_inode.direct[i], buf_ptr);
-        buf_ptr += UFS_BLOCK_SIZE;
-        remaining_size -= UFS_BLOCK_SIZE;
+    // write the updated directory entries back to disk, through the block
+    // map so that this works for every format. The slots freed at the end
+    // are zeroed
+    int parent_block_count = (parent_inode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+    vector<unsigned int> parent_blocks;
+    if (fileBlocks(&parent_inode, parent_block_count, parent_blocks) != 0) {
+        return -EINVALIDINODE;
     }
+    dir_entries.resize(parent_block_count * UFS_BLOCK_SIZE / sizeof(dir_ent_t));
+    vector<int> block_numbers;
+    vector<struct iovec> buffers;
+    blockVector(parent_blocks, parent_block_count, reinterpret_cast<unsigned char *>(dir_entries.data()),
+                block_numbers, buffers);
+    disk->writeBlocks(parent_block_count, block_numbers.data(), buffers.data());
 
     // update the parent directory size
     parent_inode.size -= sizeof(dir_ent_t);
 
-    // update the inode table
-    inode_t inode_table[super.num_inodes];
-    readInodeRegion(&super, inode_table);
-    inode_table[parentInodeNumber] = parent_inode;
-    writeInodeRegion(&super, inode_table);
+    // update the parent inode
+    writeInode(&superBlock, parentInodeNumber, &parent_inode);
+
+    // a removed directory's inode number can come back as a different
+    // directory, its counter moving at commit retires what was cached of it
+    transactionEntries[parentInodeNumber][name] = -ENOTFOUND;
 
     return 0;
 }
@@ -3,10 +3,22 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+// Responses go out in a single write each, so Nagle's algorithm only
+// delays the next response on a kept-alive or pipelined connection until
+// the client's delayed ack for the previous one
+static void setNoDelay(int clientFd)
+{
+    int one = 1;
+    setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
 
 MyServerSocket::MyServerSocket(int port)
 {
@@ -30,8 +42,8 @@ MyServerSocket::MyServerSocket(int port)
         throw SocketError(str);
     }	
     
-    //set up a listen queue
-    listen(serverFd, 10);
+    //set up a listen queue, long enough for bursts of connections
+    listen(serverFd, SOMAXCONN);
 }
 
 MySocket *MyServerSocket::accept()
@@ -45,6 +57,32 @@ MySocket *MyServerSocket::accept()
     if(clientFd<0) {
       throw SocketError("accept error");
     }
+    setNoDelay(clientFd);
     
     return new MySocket(clientFd);
 }
+
+MySocket *MyServerSocket::tryAccept()
+{
+    struct sockaddr_in client;
+    socklen_t len = sizeof(client);
+    int clientFd = ::accept4(serverFd, (struct sockaddr *) &client, &len, SOCK_NONBLOCK);
+
+    if(clientFd<0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED || errno == EINTR) {
+        return NULL;
+      }
+      throw SocketError("accept error");
+    }
+    setNoDelay(clientFd);
+
+    return new MySocket(clientFd);
+}
+
+void MyServerSocket::setNonBlocking()
+{
+    int flags = fcntl(serverFd, F_GETFL, 0);
+    if (flags < 0 || fcntl(serverFd, F_SETFL, flags | O_NONBLOCK) < 0) {
+      throw SocketError("could not make server socket non-blocking");
+    }
+}
@@ -0,0 +1,28 @@
+#include <sstream>
+
+#include "StatsService.h"
+#include "ClientError.h"
+
+using namespace std;
+
+StatsService::StatsService(LocalFileSystem *fileSystem) : HttpService("/stats") {
+  this->fileSystem = fileSystem;
+}
+
+void StatsService::get(HTTPRequest *request, HTTPResponse *response) {
+  if (request->getPath() != "/stats") {
+    throw ClientError::notFound();
+  }
+
+  // one "name value" pair per line, like ds3bits prints them
+  stringstream body;
+  body << "num_inodes " << fileSystem->superBlock.num_inodes << endl;
+  body << "num_data " << fileSystem->superBlock.num_data << endl;
+  body << "free_inodes " << fileSystem->freeInodeCount() << endl;
+  body << "free_data " << fileSystem->freeDataBlockCount() << endl;
+  body << "cache_hits " << fileSystem->disk->cacheHits() << endl;
+  body << "cache_misses " << fileSystem->disk->cacheMisses() << endl;
+
+  response->setContentType("text/plain");
+  response->setBody(body.str());
+}
@@ -0,0 +1,185 @@
+#include <sched.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include "WorkStealingExecutor.h"
+
+using namespace std;
+
+WorkStealingExecutor::WorkStealingExecutor(int workers, Task task) {
+  int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1) {
+    cpus = 1;
+  }
+  if (workers < 1) {
+    workers = cpus;
+  }
+
+  m_task = task;
+  m_sleepers = 0;
+  m_searching = 0;
+  m_steals = 0;
+  m_nextWorker = 0;
+  m_cpuWorkers.assign(cpus, -1);
+
+  for (int idx = 0; idx < workers; idx++) {
+    Worker *worker = new Worker();
+    worker->executor = this;
+    worker->index = idx;
+    worker->cpu = idx % cpus;
+    worker->queued = 0;
+    worker->sleeping = false;
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+    if (m_cpuWorkers[worker->cpu] == -1) {
+      m_cpuWorkers[worker->cpu] = idx;
+    }
+    m_workers.push_back(worker);
+  }
+
+  // start them only once m_workers is complete, they steal from each other
+  for (int idx = 0; idx < workers; idx++) {
+    Worker *worker = m_workers[idx];
+    if (pthread_create(&worker->thread, NULL, run, worker) != 0) {
+      cerr << "Could not start executor worker" << endl;
+      exit(1);
+    }
+    pthread_detach(worker->thread);
+
+    // pinning is best effort, a worker that cannot be pinned still works
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(worker->cpu, &cpuSet);
+    pthread_setaffinity_np(worker->thread, sizeof(cpuSet), &cpuSet);
+  }
+}
+
+void WorkStealingExecutor::submit(void *arg) {
+  // the worker on this core if there is one, otherwise spread them out
+  int cpu = sched_getcpu();
+  int worker = -1;
+  if (cpu >= 0 && cpu < (int) m_cpuWorkers.size()) {
+    worker = m_cpuWorkers[cpu];
+  }
+  if (worker == -1) {
+    worker = m_nextWorker++ % m_workers.size();
+  }
+  submitTo(worker, arg);
+}
+
+void WorkStealingExecutor::submitTo(int index, void *arg) {
+  Worker *worker = m_workers[index % m_workers.size()];
+  pthread_mutex_lock(&worker->lock);
+  worker->items.push_back(arg);
+  worker->queued++;
+  bool wasSleeping = worker->sleeping;
+  if (wasSleeping) {
+    worker->sleeping = false;
+    pthread_cond_signal(&worker->wake);
+  }
+  pthread_mutex_unlock(&worker->lock);
+
+  // the owner is busy, let somebody who is not come and take it, unless
+  // a worker is already out looking and will find it
+  if (!wasSleeping && m_searching.load() == 0 && m_sleepers.load() > 0) {
+    wakeIdleWorker(worker);
+  }
+}
+
+void WorkStealingExecutor::wakeIdleWorker(Worker *except) {
+  for (unsigned int idx = 0; idx < m_workers.size(); idx++) {
+    Worker *worker = m_workers[idx];
+    if (worker == except) {
+      continue;
+    }
+    pthread_mutex_lock(&worker->lock);
+    bool wasSleeping = worker->sleeping;
+    if (wasSleeping) {
+      worker->sleeping = false;
+      pthread_cond_signal(&worker->wake);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    if (wasSleeping) {
+      return;
+    }
+  }
+}
+
+bool WorkStealingExecutor::take(Worker *worker, void **arg) {
+  pthread_mutex_lock(&worker->lock);
+  bool found = !worker->items.empty();
+  if (found) {
+    *arg = worker->items.front();
+    worker->items.pop_front();
+    worker->queued--;
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return found;
+}
+
+bool WorkStealingExecutor::steal(Worker *thief, void **arg) {
+  // start at the next worker so that thieves do not all pick on worker 0
+  int count = m_workers.size();
+  for (int offset = 1; offset < count; offset++) {
+    Worker *victim = m_workers[(thief->index + offset) % count];
+    // skip empty queues without taking their locks
+    if (victim->queued.load() == 0) {
+      continue;
+    }
+    pthread_mutex_lock(&victim->lock);
+    bool found = !victim->items.empty();
+    if (found) {
+      *arg = victim->items.back();
+      victim->items.pop_back();
+      victim->queued--;
+    }
+    pthread_mutex_unlock(&victim->lock);
+    if (found) {
+      m_steals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void *WorkStealingExecutor::run(void *arg) {
+  Worker *worker = static_cast<Worker *>(arg);
+  WorkStealingExecutor *executor = worker->executor;
+  while (true) {
+    void *item;
+    if (executor->take(worker, &item)) {
+      executor->m_task(item);
+      continue;
+    }
+    executor->m_searching++;
+    bool stolen = executor->steal(worker, &item);
+    executor->m_searching--;
+    if (stolen) {
+      executor->m_task(item);
+      continue;
+    }
+
+    // nothing anywhere. Announce that we are going to sleep and look once
+    // more: a submit either sees us as a sleeper and wakes somebody, or
+    // pushed before this second sweep and we find its item
+    pthread_mutex_lock(&worker->lock);
+    worker->sleeping = true;
+    pthread_mutex_unlock(&worker->lock);
+    executor->m_sleepers++;
+    bool found = executor->take(worker, &item) || executor->steal(worker, &item);
+
+    pthread_mutex_lock(&worker->lock);
+    while (worker->sleeping && !found) {
+      pthread_cond_wait(&worker->wake, &worker->lock);
+    }
+    worker->sleeping = false;
+    pthread_mutex_unlock(&worker->lock);
+    executor->m_sleepers--;
+
+    if (found) {
+      executor->m_task(item);
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "LocalFileSystem.h"
+#include "Disk.h"
+#include "ufs.h"
+
+using namespace std;
+
+/*
+ * Counts the system calls and the time that the file system operations
+ * behind a PUT and a GET cost: creating a file, writing it and reading it
+ * back, each in its own transaction the way ds3touch, ds3cp and ds3cat do
+ * them, plus opening the image once. The calls Disk makes on the image
+ * are counted by wrapping their libc functions in this program, so
+ * nothing has to be preloaded.
+ *
+ *   disk_bench [-n files] [-s bytes] [-c cacheBlocks] [-m] image
+ *
+ * Run it on a scratch image from mkfs, it adds files to the root
+ * directory. The cache is off by default so that every block read goes
+ * to the image.
+ */
+
+int FILES = 100;
+int FILE_SIZE = 10000;
+int CACHE_BLOCKS = 0;
+bool USE_MMAP = false;
+
+enum {OPEN, CLOSE, LSEEK, READ, WRITE, PREAD, PWRITE, PREADV, PWRITEV, FSYNC, FDATASYNC, MSYNC, NUM_CALLS};
+const char *CALL_NAMES[NUM_CALLS] = {"open", "close", "lseek", "read", "write", "pread", "pwrite",
+                                     "preadv", "pwritev", "fsync", "fdatasync", "msync"};
+long callCounts[NUM_CALLS];
+// only calls made while an operation is measured count, not our own output
+bool counting = false;
+
+static void *realFunction(const char *name) {
+  void *function = dlsym(RTLD_NEXT, name);
+  if (function == NULL) {
+    cerr << "disk_bench: no " << name << " in libc" << endl;
+    exit(1);
+  }
+  return function;
+}
+
+static void countCall(int call) {
+  if (counting) {
+    callCounts[call]++;
+  }
+}
+
+extern "C" {
+
+int open(const char *path, int flags, ...) {
+  static int (*real)(const char *, int, ...) = (int (*)(const char *, int, ...)) realFunction("open");
+  va_list args;
+  va_start(args, flags);
+  int mode = va_arg(args, int);
+  va_end(args);
+  countCall(OPEN);
+  return real(path, flags, mode);
+}
+
+int close(int fd) {
+  static int (*real)(int) = (int (*)(int)) realFunction("close");
+  countCall(CLOSE);
+  return real(fd);
+}
+
+off_t lseek(int fd, off_t offset, int whence) {
+  static off_t (*real)(int, off_t, int) = (off_t (*)(int, off_t, int)) realFunction("lseek");
+  countCall(LSEEK);
+  return real(fd, offset, whence);
+}
+
+ssize_t read(int fd, void *buffer, size_t count) {
+  static ssize_t (*real)(int, void *, size_t) = (ssize_t (*)(int, void *, size_t)) realFunction("read");
+  countCall(READ);
+  return real(fd, buffer, count);
+}
+
+ssize_t write(int fd, const void *buffer, size_t count) {
+  static ssize_t (*real)(int, const void *, size_t) = (ssize_t (*)(int, const void *, size_t)) realFunction("write");
+  countCall(WRITE);
+  return real(fd, buffer, count);
+}
+
+ssize_t pread(int fd, void *buffer, size_t count, off_t offset) {
+  static ssize_t (*real)(int, void *, size_t, off_t) = (ssize_t (*)(int, void *, size_t, off_t)) realFunction("pread");
+  countCall(PREAD);
+  return real(fd, buffer, count, offset);
+}
+
+ssize_t pwrite(int fd, const void *buffer, size_t count, off_t offset) {
+  static ssize_t (*real)(int, const void *, size_t, off_t) =
+    (ssize_t (*)(int, const void *, size_t, off_t)) realFunction("pwrite");
+  countCall(PWRITE);
+  return real(fd, buffer, count, offset);
+}
+
+ssize_t preadv(int fd, const struct iovec *buffers, int count, off_t offset) {
+  static ssize_t (*real)(int, const struct iovec *, int, off_t) =
+    (ssize_t (*)(int, const struct iovec *, int, off_t)) realFunction("preadv");
+  countCall(PREADV);
+  return real(fd, buffers, count, offset);
+}
+
+ssize_t pwritev(int fd, const struct iovec *buffers, int count, off_t offset) {
+  static ssize_t (*real)(int, const struct iovec *, int, off_t) =
+    (ssize_t (*)(int, const struct iovec *, int, off_t)) realFunction("pwritev");
+  countCall(PWRITEV);
+  return real(fd, buffers, count, offset);
+}
+
+int fsync(int fd) {
+  static int (*real)(int) = (int (*)(int)) realFunction("fsync");
+  countCall(FSYNC);
+  return real(fd);
+}
+
+int fdatasync(int fd) {
+  static int (*real)(int) = (int (*)(int)) realFunction("fdatasync");
+  countCall(FDATASYNC);
+  return real(fd);
+}
+
+int msync(void *address, size_t length, int flags) {
+  static int (*real)(void *, size_t, int) = (int (*)(void *, size_t, int)) realFunction("msync");
+  countCall(MSYNC);
+  return real(address, length, flags);
+}
+
+}
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void startCounting() {
+  for (int call = 0; call < NUM_CALLS; call++) {
+    callCounts[call] = 0;
+  }
+  counting = true;
+}
+
+// one line per phase: system calls per operation, by kind, and the time
+static void report(string phase, int operations, double seconds) {
+  counting = false;
+  long total = 0;
+  for (int call = 0; call < NUM_CALLS; call++) {
+    total += callCounts[call];
+  }
+  cout << left << setw(8) << phase << right << fixed << setprecision(1)
+       << " syscalls/op " << setw(6) << (double) total / operations
+       << "  us/op " << setw(8) << seconds * 1e6 / operations << " ";
+  for (int call = 0; call < NUM_CALLS; call++) {
+    if (callCounts[call] > 0) {
+      cout << " " << CALL_NAMES[call] << "=" << (double) callCounts[call] / operations;
+    }
+  }
+  cout << endl;
+}
+
+int main(int argc, char *argv[]) {
+  int option;
+  while ((option = getopt(argc, argv, "n:s:c:m")) != -1) {
+    switch (option) {
+    case 'n':
+      FILES = atoi(optarg);
+      break;
+    case 's':
+      FILE_SIZE = atoi(optarg);
+      break;
+    case 'c':
+      CACHE_BLOCKS = atoi(optarg);
+      break;
+    case 'm':
+      USE_MMAP = true;
+      break;
+    default:
+      cerr << "usage: " << argv[0] << " [-n files] [-s bytes] [-c cacheBlocks] [-m] image" << endl;
+      exit(1);
+    }
+  }
+  if (optind != argc - 1 || FILES < 1 || FILE_SIZE < 0) {
+    cerr << "usage: " << argv[0] << " [-n files] [-s bytes] [-c cacheBlocks] [-m] image" << endl;
+    exit(1);
+  }
+
+  // what each of the command line tools pays once before its operation
+  startCounting();
+  double start = now();
+  Disk *disk = new Disk(argv[optind], UFS_BLOCK_SIZE, USE_MMAP);
+  if (!USE_MMAP) {
+    disk->setCacheSize(CACHE_BLOCKS);
+  }
+  LocalFileSystem *fileSystem = new LocalFileSystem(disk);
+  report("mount", 1, now() - start);
+
+  vector<char> contents(FILE_SIZE, 'x');
+  vector<char> readBack(FILE_SIZE);
+  vector<int> inodes;
+
+  string prefix = "bench" + to_string(getpid()) + "_";
+  startCounting();
+  start = now();
+  for (int idx = 0; idx < FILES; idx++) {
+    fileSystem->beginTransaction();
+    int inode = fileSystem->create(UFS_ROOT_DIRECTORY_INODE_NUMBER, UFS_REGULAR_FILE, prefix + to_string(idx));
+    if (inode < 0) {
+      counting = false;
+      fileSystem->rollback();
+      cerr << "Could not create file " << idx << ": " << inode << endl;
+      exit(1);
+    }
+    fileSystem->commit();
+    inodes.push_back(inode);
+  }
+  report("create", FILES, now() - start);
+
+  startCounting();
+  start = now();
+  for (int idx = 0; idx < FILES; idx++) {
+    fileSystem->beginTransaction();
+    if (fileSystem->write(inodes[idx], contents.data(), FILE_SIZE) != FILE_SIZE) {
+      counting = false;
+      fileSystem->rollback();
+      cerr << "Could not write file " << idx << endl;
+      exit(1);
+    }
+    fileSystem->commit();
+  }
+  report("write", FILES, now() - start);
+
+  startCounting();
+  start = now();
+  for (int idx = 0; idx < FILES; idx++) {
+    if (fileSystem->read(inodes[idx], readBack.data(), FILE_SIZE) != FILE_SIZE) {
+      counting = false;
+      cerr << "Could not read file " << idx << endl;
+      exit(1);
+    }
+  }
+  report("read", FILES, now() - start);
+
+  delete fileSystem;
+  delete disk;
+  return 0;
+}
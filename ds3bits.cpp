@@ -2,6 +2,7 @@
 #include <string>
 #include <cstring>
 #include <algorithm>
+#include <vector>
 
 #include "LocalFileSystem.h"
 #include "Disk.h"
@@ -10,6 +11,22 @@
 using namespace std;
 
 int main(int argc, char *argv[]) {
+    // optional leading flags: -m serves the image through mmap, -s also
+    // prints the format version, the free inode and data block counts and
+    // how fragmented free space and files are
+    bool useMmap = false;
+    bool showFree = false;
+    while (argc > 1 && (string(argv[1]) == "-m" || string(argv[1]) == "-s")) {
+        if (string(argv[1]) == "-m") {
+            useMmap = true;
+        } else {
+            showFree = true;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     if (argc != 2) {
         cerr << argv[0] << ": diskImageFile" << endl;
         return 1;
@@ -19,20 +36,19 @@ int main(int argc, char *argv[]) {
     int blockSize = UFS_BLOCK_SIZE;
 
     // create disk and filesystem objects
-    Disk disk(argv[1], blockSize);
+    Disk disk(argv[1], blockSize, useMmap);
     LocalFileSystem fs(&disk);
 
-    // read the superblock to get filesystem metadata
-    super_t super;
-    fs.readSuperBlock(&super);
+    // the filesystem loads the superblock and its geometry once at mount
+    super_t &super = fs.superBlock;
 
     // print superblock information
     cout << "Super" << endl;
     cout << "inode_region_addr " << super.inode_region_addr << endl;
     cout << "inode_region_len " << super.inode_region_len << endl;
 
-    // calculate the total number of inodes in the inode region
-    int computedNumInodes = (super.inode_region_len * blockSize) / sizeof(inode_t);
+    // the total number of inodes that fit in the inode region
+    int computedNumInodes = fs.inodeRegionCapacity;
     cout << "num_inodes " << computedNumInodes << endl;
 
     cout << "data_region_addr " << super.data_region_addr << endl;
@@ -45,11 +61,8 @@ int main(int argc, char *argv[]) {
     cout << endl;
 
     // read inode and data bitmaps from the filesystem
-    int inodeBitmapSize = super.inode_bitmap_len * blockSize;
-    int dataBitmapSize  = super.data_bitmap_len  * blockSize;
-
-    unsigned char* inodeBitmap = new unsigned char[inodeBitmapSize];
-    unsigned char* dataBitmap  = new unsigned char[dataBitmapSize];
+    unsigned char* inodeBitmap = new unsigned char[fs.inodeBitmapSize];
+    unsigned char* dataBitmap  = new unsigned char[fs.dataBitmapSize];
 
     fs.readInodeBitmap(&super, inodeBitmap);
     fs.readDataBitmap(&super, dataBitmap);
@@ -72,6 +85,59 @@ int main(int argc, char *argv[]) {
     }
     cout << endl;
 
+    if (showFree) {
+        cout << endl << "Format" << endl;
+        cout << "version " << super.version << endl;
+
+        cout << endl << "Free" << endl;
+        cout << "inodes " << fs.freeInodeCount() << endl;
+        cout << "data " << fs.freeDataBlockCount() << endl;
+
+        // runs of free data blocks, and runs of adjacent blocks in files.
+        // One run per file is as good as it gets
+        int freeRuns = 0;
+        int largestFreeRun = 0;
+        for (int i = 0; i < computedNumData; ) {
+            if (dataBitmap[i / 8] & (1 << (i % 8))) {
+                i++;
+                continue;
+            }
+            int run = 0;
+            while (i < computedNumData && !(dataBitmap[i / 8] & (1 << (i % 8)))) {
+                run++;
+                i++;
+            }
+            freeRuns++;
+            largestFreeRun = max(largestFreeRun, run);
+        }
+
+        int files = 0;
+        int fileRuns = 0;
+        for (int inum = 0; inum < super.num_inodes; inum++) {
+            inode_t inode;
+            if (!(inodeBitmap[inum / 8] & (1 << (inum % 8))) || fs.stat(inum, &inode) != 0) {
+                continue;
+            }
+            vector<unsigned int> blocks;
+            int numBlocks = (inode.size + blockSize - 1) / blockSize;
+            if (numBlocks == 0 || fs.fileBlocks(&inode, numBlocks, blocks) != 0) {
+                continue;
+            }
+            files++;
+            for (int i = 0; i < numBlocks; i++) {
+                if (i == 0 || blocks[i] != blocks[i - 1] + 1) {
+                    fileRuns++;
+                }
+            }
+        }
+
+        cout << endl << "Fragmentation" << endl;
+        cout << "free_runs " << freeRuns << endl;
+        cout << "largest_free_run " << largestFreeRun << endl;
+        cout << "files " << files << endl;
+        cout << "file_runs " << fileRuns << endl;
+    }
+
     // free allocated memory
     delete[] inodeBitmap;
     delete[] dataBitmap;
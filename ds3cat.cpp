@@ -9,6 +9,15 @@
 using namespace std;
 
 int main(int argc, char *argv[]) {
+    // an optional leading -m serves the image through mmap
+    bool useMmap = false;
+    if (argc > 1 && string(argv[1]) == "-m") {
+        useMmap = true;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     if (argc != 3) {
         cerr << "Usage: ds3cat <disk_image_file> <inode_number>" << endl;
         return 1;
@@ -23,7 +32,7 @@ int main(int argc, char *argv[]) {
     }
 
     try {
-        Disk disk(argv[1], UFS_BLOCK_SIZE);
+        Disk disk(argv[1], UFS_BLOCK_SIZE, useMmap);
         LocalFileSystem fs(&disk);
 
         // Check inode validity
@@ -43,12 +52,17 @@ int main(int argc, char *argv[]) {
         // Print file blocks
         cout << "File blocks" << endl;
         int numBlocks = (inode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+        vector<unsigned int> blocks;
+        if (fs.fileBlocks(&inode, numBlocks, blocks) != 0) {
+            cerr << "Error: Inode contains an invalid block address." << endl;
+            return 1;
+        }
         for (int i = 0; i < numBlocks; i++) {
-            if (inode.direct[i] == 0) {
+            if (blocks[i] == 0) {
                 cerr << "Error: Inode contains an invalid block address." << endl;
                 return 1;
             }
-            cout << inode.direct[i] << endl;
+            cout << blocks[i] << endl;
         }
 
         // Insert a blank line after the file blocks (as expected)
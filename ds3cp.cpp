@@ -9,6 +9,15 @@
 using namespace std;
 
 int main(int argc, char *argv[]) {
+    // an optional leading -m serves the image through mmap
+    bool useMmap = false;
+    if (argc > 1 && string(argv[1]) == "-m") {
+        useMmap = true;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     if (argc != 4) {
         cerr << argv[0] << ": diskimagefile src_file dst_inode" << endl;
         cerr << "for example:" << endl;
@@ -67,14 +76,16 @@ int main(int argc, char *argv[]) {
     }
 
     // create our disk and fs objects
-    Disk *disk = new Disk(diskImageFile.c_str(), UFS_BLOCK_SIZE);
+    Disk *disk = new Disk(diskImageFile.c_str(), UFS_BLOCK_SIZE, useMmap);
     LocalFileSystem *fs = new LocalFileSystem(disk);
 
     // write the file data to the given inode
+    fs->beginTransaction();
     int bytesWritten = fs->write(dstInode, buffer, fileSize);
     delete[] buffer;
 
     if (bytesWritten < 0) {
+        fs->rollback();
         cerr << "Could not write to dst_file" << endl;
         delete fs;
         delete disk;
@@ -82,6 +93,7 @@ int main(int argc, char *argv[]) {
     }
 
     // clean up and exit
+    fs->commit();
     delete fs;
     delete disk;
     return 0;
@@ -114,6 +114,15 @@ void listDirectory(LocalFileSystem *fs, int inodeNumber, const string &path) {
 }
 
 int main(int argc, char *argv[]) {
+    // an optional leading -m serves the image through mmap
+    bool useMmap = false;
+    if (argc > 1 && string(argv[1]) == "-m") {
+        useMmap = true;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     if (argc != 3) {
         cerr << argv[0] << ": diskimagefile directory" << endl;
         cerr << "for example:" << endl;
@@ -122,7 +131,7 @@ int main(int argc, char *argv[]) {
     }
 
     // open disk image and create fs object
-    Disk *disk = new Disk(argv[1], UFS_BLOCK_SIZE);
+    Disk *disk = new Disk(argv[1], UFS_BLOCK_SIZE, useMmap);
     LocalFileSystem *fs = new LocalFileSystem(disk);
     string path = argv[2];
 
@@ -7,6 +7,15 @@
 using namespace std;
 
 int main(int argc, char *argv[]) {
+    // an optional leading -m serves the image through mmap
+    bool useMmap = false;
+    if (argc > 1 && string(argv[1]) == "-m") {
+        useMmap = true;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     if (argc != 4) {
         cerr << argv[0] << ": diskimagefile parentinode name" << endl;
         cerr << "for example:" << endl;
@@ -26,14 +35,17 @@ int main(int argc, char *argv[]) {
     
     try {
         // use automatic objects so destructors are called properly
-        Disk disk(argv[1], UFS_BLOCK_SIZE);
+        Disk disk(argv[1], UFS_BLOCK_SIZE, useMmap);
         LocalFileSystem fs(&disk);
         
+        fs.beginTransaction();
         int ret = fs.unlink(parentInode, entryName);
         if (ret < 0) {
+            fs.rollback();
             cerr << "Error removing entry" << endl;
             return 1;
         }
+        fs.commit();
     } catch (...) {
         cerr << "Error removing entry" << endl;
         return 1;
@@ -3,6 +3,15 @@
 #include "LocalFileSystem.h"
 
 int main(int argc, char *argv[]) {
+    // an optional leading -m serves the image through mmap
+    bool useMmap = false;
+    if (argc > 1 && std::string(argv[1]) == "-m") {
+        useMmap = true;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     if (argc != 4) {
         std::cerr << "Usage: ds3touch <disk image> <parent inode> <file name>" << std::endl;
         return 1;
@@ -12,14 +21,17 @@ int main(int argc, char *argv[]) {
     int parentInode = std::stoi(argv[2]);
     std::string fileName = argv[3];
 
-    Disk disk(diskImage, UFS_BLOCK_SIZE);
+    Disk disk(diskImage, UFS_BLOCK_SIZE, useMmap);
     LocalFileSystem fs(&disk);
 
+    fs.beginTransaction();
     int result = fs.create(parentInode, UFS_REGULAR_FILE, fileName);
     if (result < 0) {
+        fs.rollback();
         std::cerr << "Error creating file" << std::endl;
         return 1;
     }
+    fs.commit();
 
     return 0;
 }
@@ -0,0 +1,50 @@
+#include <iostream>
+#include <string>
+#include "LocalFileSystem.h"
+#include "Disk.h"
+#include "ufs.h"
+
+using namespace std;
+
+int main(int argc, char *argv[]) {
+    // an optional leading -m serves the image through mmap
+    bool useMmap = false;
+    if (argc > 1 && string(argv[1]) == "-m") {
+        useMmap = true;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    if (argc != 4) {
+        cerr << argv[0] << ": diskimagefile inode size" << endl;
+        cerr << "for example:" << endl;
+        cerr << "    $ " << argv[0] << " a.img 1 8192" << endl;
+        return 1;
+    }
+
+    int inode;
+    int size;
+    try {
+        inode = stoi(argv[2]);
+        size = stoi(argv[3]);
+    } catch (...) {
+        cerr << "Error truncating file" << endl;
+        return 1;
+    }
+
+    Disk disk(argv[1], UFS_BLOCK_SIZE, useMmap);
+    LocalFileSystem fs(&disk);
+
+    // shrinking frees the blocks past the new end, growing zero-fills up to it
+    fs.beginTransaction();
+    int ret = fs.truncate(inode, size);
+    if (ret < 0) {
+        fs.rollback();
+        cerr << "Error truncating file" << endl;
+        return 1;
+    }
+    fs.commit();
+
+    return 0;
+}
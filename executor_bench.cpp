@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "WorkStealingExecutor.h"
+#include "StringUtils.h"
+
+using namespace std;
+
+/*
+ * Compares the work-stealing executor with the single mutex-protected
+ * queue that gunrock_web uses by default, at several worker counts.
+ * Producer threads submit tiny tasks as fast as they can, the way an
+ * acceptor hands over connections, and the time until every task has
+ * run is reported.
+ */
+
+int TASKS = 1000000;
+int PRODUCERS = 1;
+int SPIN = 200;
+
+atomic<long> remaining;
+atomic<unsigned long> sink;
+
+void task(void *arg) {
+  // a little work so that tasks are not free
+  unsigned long value = (unsigned long) arg;
+  for (int i = 0; i < SPIN; i++) {
+    value = value * 6364136223846793005UL + 1442695040888963407UL;
+  }
+  sink += value;
+  remaining--;
+}
+
+// the same bounded queue with one lock and two conditions as gunrock.cpp
+class SharedQueueExecutor {
+ public:
+  SharedQueueExecutor(int workers, int slots) {
+    m_slots = slots;
+    pthread_mutex_init(&m_lock, NULL);
+    pthread_cond_init(&m_notEmpty, NULL);
+    pthread_cond_init(&m_notFull, NULL);
+    for (int idx = 0; idx < workers; idx++) {
+      pthread_t thread;
+      pthread_create(&thread, NULL, run, this);
+      pthread_detach(thread);
+    }
+  }
+
+  void submit(void *arg) {
+    pthread_mutex_lock(&m_lock);
+    while ((int) m_items.size() >= m_slots) {
+      pthread_cond_wait(&m_notFull, &m_lock);
+    }
+    m_items.push_back(arg);
+    pthread_cond_signal(&m_notEmpty);
+    pthread_mutex_unlock(&m_lock);
+  }
+
+ private:
+  static void *run(void *arg) {
+    SharedQueueExecutor *executor = static_cast<SharedQueueExecutor *>(arg);
+    while (true) {
+      pthread_mutex_lock(&executor->m_lock);
+      while (executor->m_items.empty()) {
+        pthread_cond_wait(&executor->m_notEmpty, &executor->m_lock);
+      }
+      void *item = executor->m_items.front();
+      executor->m_items.pop_front();
+      pthread_cond_signal(&executor->m_notFull);
+      pthread_mutex_unlock(&executor->m_lock);
+      task(item);
+    }
+    return NULL;
+  }
+
+  int m_slots;
+  deque<void *> m_items;
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_notEmpty;
+  pthread_cond_t m_notFull;
+};
+
+struct Producer {
+  SharedQueueExecutor *shared;
+  WorkStealingExecutor *stealing;
+  int tasks;
+};
+
+void *produce(void *arg) {
+  Producer *producer = static_cast<Producer *>(arg);
+  for (long i = 0; i < producer->tasks; i++) {
+    if (producer->shared != NULL) {
+      producer->shared->submit((void *) i);
+    } else {
+      producer->stealing->submit((void *) i);
+    }
+  }
+  return NULL;
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// run TASKS tasks through one of the executors, returns seconds
+double measure(SharedQueueExecutor *shared, WorkStealingExecutor *stealing) {
+  remaining = TASKS;
+  double start = now();
+  vector<pthread_t> threads(PRODUCERS);
+  vector<Producer> producers(PRODUCERS);
+  for (int idx = 0; idx < PRODUCERS; idx++) {
+    producers[idx].shared = shared;
+    producers[idx].stealing = stealing;
+    producers[idx].tasks = TASKS / PRODUCERS + (idx < TASKS % PRODUCERS ? 1 : 0);
+    pthread_create(&threads[idx], NULL, produce, &producers[idx]);
+  }
+  for (int idx = 0; idx < PRODUCERS; idx++) {
+    pthread_join(threads[idx], NULL);
+  }
+  while (remaining.load() > 0) {
+    usleep(100);
+  }
+  return now() - start;
+}
+
+int main(int argc, char *argv[]) {
+  string workerCounts = "1,2,4,8";
+  int slots = 64;
+  int option;
+  while ((option = getopt(argc, argv, "n:p:s:t:b:")) != -1) {
+    switch (option) {
+    case 'n':
+      TASKS = atoi(optarg);
+      break;
+    case 'p':
+      PRODUCERS = atoi(optarg);
+      break;
+    case 's':
+      SPIN = atoi(optarg);
+      break;
+    case 't':
+      workerCounts = string(optarg);
+      break;
+    case 'b':
+      slots = atoi(optarg);
+      break;
+    default:
+      cerr << "usage: " << argv[0] << " [-n tasks] [-p producers] [-s spin] [-t workers,...] [-b slots]" << endl;
+      exit(1);
+    }
+  }
+  if (TASKS < 1 || PRODUCERS < 1 || slots < 1) {
+    cerr << "tasks, producers and slots must be at least 1" << endl;
+    exit(1);
+  }
+
+  // executors never stop, so each one is created once per worker count
+  // and left running idle afterwards
+  cout << "workers\tshared_queue_tasks_per_sec\twork_stealing_tasks_per_sec\tsteals" << endl;
+  vector<string> counts = StringUtils::split(workerCounts, ',');
+  for (unsigned int idx = 0; idx < counts.size(); idx++) {
+    int workers = atoi(counts[idx].c_str());
+    if (workers < 1) {
+      continue;
+    }
+    SharedQueueExecutor *shared = new SharedQueueExecutor(workers, slots);
+    double sharedSeconds = measure(shared, NULL);
+    WorkStealingExecutor *stealing = new WorkStealingExecutor(workers, task);
+    double stealingSeconds = measure(NULL, stealing);
+    cout << workers << "\t" << (long) (TASKS / sharedSeconds) << "\t" << (long) (TASKS / stealingSeconds)
+         << "\t" << stealing->steals() << endl;
+  }
+  return 0;
+}
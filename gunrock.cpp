@@ -3,24 +3,34 @@
 #include <assert.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <ctype.h>
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <vector>
 #include <sstream>
 #include <deque>
+#include <queue>
 
 #include "ClientError.h"
 #include "HTTPRequest.h"
 #include "HTTPResponse.h"
 #include "HttpService.h"
+#include "AsyncHttpService.h"
+#include "Coroutine.h"
 #include "HttpUtils.h"
 #include "FileService.h"
 #include "DistributedFileSystemService.h"
+#include "StatsService.h"
+#include "Disk.h"
+#include "ufs.h"
 #include "MySocket.h"
 #include "MyServerSocket.h"
 #include "dthread.h"
+#include "WorkStealingExecutor.h"
+#include "EventLoop.h"
 
 using namespace std;
 int PORT = 8080;
@@ -30,9 +40,55 @@ string BASEDIR = "static";
 string SCHEDALG = "FIFO";
 string LOGFILE = "/dev/null";
 string DISKFILE = "disk.img";
+int GROUP_COMMIT_WINDOW = 0;
+int CACHE_BLOCKS = DEFAULT_CACHE_BLOCKS;
+bool USE_MMAP = false;
+// size of the io_uring that image I/O goes through, 0 for pread/pwrite
+int IO_RING_ENTRIES = 0;
+bool WORK_STEALING = false;
+bool EVENT_LOOP = false;
+// serve requests as coroutines on the event loop's thread
+bool ASYNC_HANDLERS = false;
+bool THREAD_POOL_SIZE_SET = false;
+// seconds a connection may sit idle between requests, 0 closes it after
+// every response
+int KEEPALIVE_TIMEOUT = 0;
+int MAX_KEEPALIVE_REQUESTS = 100;
 
 vector<HttpService *> services;
 
+// An accepted connection waiting for a worker. Workers take the one with
+// the smallest key, and the oldest among equal keys. With FIFO every key
+// is 0 and the request is read by the worker. SFF and PRIORITY need the
+// request to compute the key, so the acceptor reads it first, giving up on
+// a client after SCHEDULE_READ_TIMEOUT_MILLIS. With -e the event loop has
+// always read the request already, and nothing waits on the client.
+struct QueuedConnection {
+  MySocket *client;
+  HTTPRequest *request;
+  long key;
+  unsigned long sequence;
+};
+
+struct QueuedConnectionOrder {
+  bool operator()(const QueuedConnection &a, const QueuedConnection &b) const {
+    if (a.key != b.key) {
+      return a.key > b.key;
+    }
+    return a.sequence > b.sequence;
+  }
+};
+
+// at most BUFFER_SIZE of them
+priority_queue<QueuedConnection, vector<QueuedConnection>, QueuedConnectionOrder> connections;
+unsigned long connectionSequence = 0;
+pthread_mutex_t connectionsLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t connectionsNotEmpty = PTHREAD_COND_INITIALIZER;
+pthread_cond_t connectionsNotFull = PTHREAD_COND_INITIALIZER;
+// with -e, whether the event loop was turned away by a full queue and is
+// waiting for handlerReady()
+bool loopWaiting = false;
+
 HttpService *find_service(HTTPRequest *request) {
    // find a service that is registered for this path prefix
   for (unsigned int idx = 0; idx < services.size(); idx++) {
@@ -78,43 +134,414 @@ void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPRespo
   }
 }
 
-void handle_request(MySocket *client) {
+// how long the acceptor waits for a request under SFF and PRIORITY. It
+// accepts nobody else meanwhile, so a client that connects and sends
+// nothing is dropped after this
+#define SCHEDULE_READ_TIMEOUT_MILLIS (2000)
+
+// X-Priority values are clamped to this either way
+#define MAX_PRIORITY (1000)
+
+// read in the request, NULL if there was a problem or it took longer than
+// timeoutMillis
+HTTPRequest *read_request(MySocket *client, int timeoutMillis = -1) {
   HTTPRequest *request = new HTTPRequest(client, PORT);
-  HTTPResponse *response = new HTTPResponse();
   stringstream payload;
-  
-  // read in the request
+
   bool readResult = false;
   try {
     payload << "client: " << (void *) client;
     sync_print("read_request_enter", payload.str());
-    readResult = request->readRequest();
+    readResult = request->readRequest(-1, timeoutMillis);
     sync_print("read_request_return", payload.str());
   } catch (...) {
     // swallow it
   }    
     
   if (!readResult) {
-    // there was a problem reading in the request, bail
-    delete response;
     delete request;
     sync_print("read_request_error", payload.str());
-    return;
+    return NULL;
   }
-  
-  HttpService *service = find_service(request);
-  invoke_service_method(service, request, response);
+  return request;
+}
+
+// with -e, kept-alive connections go back to the loop between requests
+EventLoop *eventLoop = NULL;
+
+// whether the connection stays open after this response, with the headers
+// that tell the client so. Not if the request's body could not be read
+// to its end
+bool set_connection_headers(HTTPRequest *request, HTTPResponse *response) {
+  bool keepAlive = KEEPALIVE_TIMEOUT > 0 && request->isDone() && request->shouldKeepAlive() &&
+    request->requestCount() < MAX_KEEPALIVE_REQUESTS;
+  if (keepAlive) {
+    stringstream keepAliveHeader;
+    keepAliveHeader << "timeout=" << KEEPALIVE_TIMEOUT << ", max=" << MAX_KEEPALIVE_REQUESTS - request->requestCount();
+    response->setHeader("Connection", "keep-alive");
+    response->setHeader("Keep-Alive", keepAliveHeader.str());
+  } else {
+    response->setHeader("Connection", "close");
+  }
+  return keepAlive;
+}
+
+// serve one connection, reading its request first unless that already
+// happened. With -k the connection stays open for more requests, pipelined
+// ones are served straight away
+void handle_request(MySocket *client, HTTPRequest *request) {
+  stringstream payload;
+  if (request == NULL) {
+    request = read_request(client);
+  }
+  while (request != NULL) {
+    HTTPResponse *response = new HTTPResponse();
+
+    HttpService *service = find_service(request);
+    invoke_service_method(service, request, response);
+
+    // a streamed body the service did not read all of, read before the
+    // response goes out so that the client does not get reset mid-upload
+    request->finishBody();
+    bool keepAlive = set_connection_headers(request, response);
 
-  // send data back to the client and clean up
+    // send data back to the client
+    payload.str(""); payload.clear();
+    payload << " RESPONSE " << response->getStatus() << " client: " << (void *) client;
+    sync_print("write_response", payload.str());
+    cout << payload.str() << endl;
+    try {
+      client->write(response->response());
+    } catch (...) {
+      // the client went away, nothing more to send it
+      keepAlive = false;
+    }
+    delete response;
+
+    if (!keepAlive || !request->reset()) {
+      break;
+    }
+    if (request->isReady()) {
+      // pipelined behind the last one
+      continue;
+    }
+    if (eventLoop != NULL) {
+      eventLoop->resume(client, request);
+      return;
+    }
+
+    bool readResult = false;
+    try {
+      readResult = request->readRequest(KEEPALIVE_TIMEOUT * 1000);
+    } catch (...) {
+      // swallow it
+    }
+    if (!readResult) {
+      break;
+    }
+  }
+
+  // there was a problem reading in a request, or the connection is done
+  delete request;
   payload.str(""); payload.clear();
+  payload << " client: " << (void *) client;
+  sync_print("close_connection", payload.str());
+  client->close();
+  delete client;
+}
+
+// worker thread: take the next queued connection by SCHEDALG and serve it
+void *worker(void *arg) {
+  while (true) {
+    dthread_mutex_lock(&connectionsLock);
+    while (connections.empty()) {
+      dthread_cond_wait(&connectionsNotEmpty, &connectionsLock);
+    }
+    QueuedConnection next = connections.top();
+    connections.pop();
+    dthread_cond_signal(&connectionsNotFull);
+    bool wakeLoop = loopWaiting;
+    loopWaiting = false;
+    dthread_mutex_unlock(&connectionsLock);
+    if (wakeLoop) {
+      eventLoop->handlerReady();
+    }
+
+    handle_request(next.client, next.request);
+  }
+  return NULL;
+}
+
+// work-stealing executor task, the connection stays with the worker on
+// the core that accepted it unless an idle worker steals it
+void serve_connection(void *arg) {
+  QueuedConnection *queued = static_cast<QueuedConnection *>(arg);
+  handle_request(queued->client, queued->request);
+  delete queued;
+}
+
+WorkStealingExecutor *executor = NULL;
+
+// the scheduling key of a request that has been read: the size of what it
+// reads or writes for SFF, minus its X-Priority header for PRIORITY. A
+// priority that is not a number counts as the default, 0
+long schedule_key(HTTPRequest *request) {
+  if (SCHEDALG == "SFF") {
+    HttpService *service = find_service(request);
+    return (service == NULL) ? 0 : service->requestSize(request);
+  }
+  string header;
+  if (!request->findHeader("X-Priority", header)) {
+    return 0;
+  }
+  char *end;
+  long priority = strtol(header.c_str(), &end, 10);
+  while (isspace((unsigned char) *end)) {
+    end++;
+  }
+  if (end == header.c_str() || *end != '\0') {
+    return 0;
+  }
+  return -max((long) -MAX_PRIORITY, min(priority, (long) MAX_PRIORITY));
+}
+
+// acceptor side: hand the connection to a worker, waiting for a free slot
+// if wait is set. request is NULL if it has not been read yet. Without
+// wait, false says that every slot is taken and the connection is still
+// the caller's
+bool enqueue_connection(MySocket *client, HTTPRequest *request, bool wait) {
+  QueuedConnection queued;
+  queued.client = client;
+  queued.request = request;
+  queued.key = 0;
+  if (executor != NULL) {
+    executor->submit(new QueuedConnection(queued));
+    return true;
+  }
+  if (SCHEDALG != "FIFO") {
+    if (queued.request == NULL) {
+      queued.request = read_request(client, SCHEDULE_READ_TIMEOUT_MILLIS);
+    }
+    if (queued.request == NULL) {
+      client->close();
+      delete client;
+      return true;
+    }
+    queued.key = schedule_key(queued.request);
+  }
+
+  dthread_mutex_lock(&connectionsLock);
+  while ((int) connections.size() >= BUFFER_SIZE) {
+    if (!wait) {
+      loopWaiting = true;
+      dthread_mutex_unlock(&connectionsLock);
+      return false;
+    }
+    dthread_cond_wait(&connectionsNotFull, &connectionsLock);
+  }
+  queued.sequence = connectionSequence++;
+  connections.push(queued);
+  dthread_cond_signal(&connectionsNotEmpty);
+  dthread_mutex_unlock(&connectionsLock);
+  return true;
+}
+
+// event loop handler for -e. The loop must not block, so a request that
+// finds the queue full stays with it until a worker makes room
+bool offer_connection(MySocket *client, HTTPRequest *request) {
+  return enqueue_connection(client, request, false);
+}
+
+// With -a the event loop's thread runs every request as a coroutine, and
+// their blocking calls go to a pool of threads
+class EventLoopScheduler : public CoroutineScheduler {
+ public:
+  EventLoopScheduler(EventLoop *loop, int threads) {
+    m_loop = loop;
+    m_pool = new WorkStealingExecutor(threads, runBlocking);
+  }
+
+  void post(Callback callback, void *arg) {
+    m_loop->post(callback, arg);
+  }
+
+  void postBlocking(Callback callback, void *arg) {
+    BlockingCallback *blocking = new BlockingCallback();
+    blocking->callback = callback;
+    blocking->arg = arg;
+    m_pool->submit(blocking);
+  }
+
+  void whenWritable(int fd, Callback callback, void *arg) {
+    m_loop->whenWritable(fd, callback, arg);
+  }
+
+ private:
+  struct BlockingCallback {
+    Callback callback;
+    void *arg;
+  };
+
+  static void runBlocking(void *arg) {
+    BlockingCallback *blocking = static_cast<BlockingCallback *>(arg);
+    blocking->callback(blocking->arg);
+    delete blocking;
+  }
+
+  EventLoop *m_loop;
+  WorkStealingExecutor *m_pool;
+};
+
+CoroutineScheduler *scheduler = NULL;
+// services[idx] as a coroutine service, itself if it is one
+vector<AsyncHttpService *> asyncServices;
+
+AsyncHttpService *find_async_service(HTTPRequest *request) {
+  for (unsigned int idx = 0; idx < services.size(); idx++) {
+    if (request->getPath().find(services[idx]->pathPrefix()) == 0) {
+      return asyncServices[idx];
+    }
+  }
+
+  return NULL;
+}
+
+Task invoke_service_method_async(AsyncHttpService *service, HTTPRequest *request, HTTPResponse *response,
+                                 ResponseWriter *writer) {
+  try {
+    if (service == NULL) {
+      response->setStatus(404);
+    } else if (request->isHead()) {
+      co_await service->head(scheduler, request, response, writer);
+    } else if (request->isGet()) {
+      co_await service->get(scheduler, request, response, writer);
+    } else if (request->isPut()) {
+      co_await service->put(scheduler, request, response, writer);
+    } else if (request->isPost()) {
+      co_await service->post(scheduler, request, response, writer);
+    } else if (request->isDelete()) {
+      co_await service->del(scheduler, request, response, writer);
+    } else if (request->isMove()) {
+      co_await service->move(scheduler, request, response, writer);
+    } else {
+      response->setStatus(501);
+    }
+  } catch (ClientError &ce) {
+    response->setStatus(ce.status_code);
+  } catch (...) {
+    response->setBody("");
+    response->setStatus(500);
+  }
+}
+
+// write all of data to a non-blocking socket, waiting whenever it is full.
+// Throws SocketWriteError if the client goes away
+Task write_async(MySocket *client, const char *data, size_t length) {
+  size_t written = 0;
+  while (written < length) {
+    int ret = client->write_some(data + written, length - written);
+    if (ret == 0) {
+      co_await writable(scheduler, client->getFd());
+    }
+    written += ret;
+  }
+}
+
+Task write_async(MySocket *client, string data) {
+  co_await write_async(client, data.data(), data.size());
+}
+
+// finish reading the request and send the response, only its status line
+// and headers if the service writes the body itself. keepAlive says whether
+// the connection stays open for another request
+Task write_response(MySocket *client, HTTPRequest *request, HTTPResponse *response, bool &keepAlive) {
+  if (!request->isDone()) {
+    co_await blocking(scheduler, [=]() { request->finishBody(); });
+  }
+  keepAlive = set_connection_headers(request, response);
+
+  stringstream payload;
   payload << " RESPONSE " << response->getStatus() << " client: " << (void *) client;
   sync_print("write_response", payload.str());
   cout << payload.str() << endl;
-  client->write(response->response());
-    
-  delete response;
-  delete request;
+  co_await write_async(client, response->response());
+}
+
+// the ResponseWriter a service gets for one request with -a
+class ConnectionWriter : public ResponseWriter {
+ public:
+  ConnectionWriter(MySocket *client, HTTPRequest *request) {
+    m_client = client;
+    m_request = request;
+    m_headWritten = false;
+    m_keepAlive = false;
+    m_bodyLeft = 0;
+  }
+
+  Task writeHead(HTTPResponse *response, long contentLength) {
+    m_headWritten = true;
+    m_bodyLeft = contentLength;
+    response->setContentLength(contentLength);
+    bool keepAlive;
+    co_await write_response(m_client, m_request, response, keepAlive);
+    m_keepAlive = keepAlive;
+  }
+
+  Task writeBody(const char *data, size_t length) {
+    co_await write_async(m_client, data, length);
+    m_bodyLeft -= length;
+  }
 
+  bool headWritten() {
+    return m_headWritten;
+  }
+
+  // a service that failed halfway through its body leaves the client
+  // waiting for the rest, only closing the connection tells it
+  bool keepAlive() {
+    return m_keepAlive && m_bodyLeft == 0;
+  }
+
+ private:
+  MySocket *m_client;
+  HTTPRequest *m_request;
+  bool m_headWritten;
+  bool m_keepAlive;
+  long m_bodyLeft;
+};
+
+// handle_request as a coroutine. The connection's socket stays
+// non-blocking, so only the service's own waiting holds anything up
+Task handle_request_async(MySocket *client, HTTPRequest *request) {
+  stringstream payload;
+  while (true) {
+    HTTPResponse *response = new HTTPResponse();
+    ConnectionWriter writer(client, request);
+
+    co_await invoke_service_method_async(find_async_service(request), request, response, &writer);
+    bool keepAlive = false;
+    if (writer.headWritten()) {
+      keepAlive = writer.keepAlive();
+    } else {
+      try {
+        co_await write_response(client, request, response, keepAlive);
+      } catch (...) {
+        keepAlive = false;
+      }
+    }
+    delete response;
+
+    if (!keepAlive || !request->reset()) {
+      break;
+    }
+    if (!request->isReady()) {
+      eventLoop->resume(client, request);
+      co_return;
+    }
+    // pipelined behind the last one
+  }
+
+  delete request;
   payload.str(""); payload.clear();
   payload << " client: " << (void *) client;
   sync_print("close_connection", payload.str());
@@ -122,12 +549,18 @@ void handle_request(MySocket *client) {
   delete client;
 }
 
+// event loop handler for -a
+bool start_request_async(MySocket *client, HTTPRequest *request) {
+  handle_request_async(client, request).detach();
+  return true;
+}
+
 int main(int argc, char *argv[]) {
 
   signal(SIGPIPE, SIG_IGN);
   int option;
 
-  while ((option = getopt(argc, argv, "d:p:t:b:s:l:i:")) != -1) {
+  while ((option = getopt(argc, argv, "d:p:t:b:s:l:i:g:c:k:r:u:mwea")) != -1) {
     switch (option) {
     case 'd':
       BASEDIR = string(optarg);
@@ -137,6 +570,7 @@ int main(int argc, char *argv[]) {
       break;
     case 't':
       THREAD_POOL_SIZE = atoi(optarg);
+      THREAD_POOL_SIZE_SET = true;
       break;
     case 'b':
       BUFFER_SIZE = atoi(optarg);
@@ -150,12 +584,53 @@ int main(int argc, char *argv[]) {
     case 'i':
       DISKFILE = string(optarg);
       break;
+    case 'g':
+      GROUP_COMMIT_WINDOW = atoi(optarg);
+      break;
+    case 'c':
+      CACHE_BLOCKS = atoi(optarg);
+      break;
+    case 'k':
+      KEEPALIVE_TIMEOUT = atoi(optarg);
+      break;
+    case 'r':
+      MAX_KEEPALIVE_REQUESTS = atoi(optarg);
+      break;
+    case 'u':
+      IO_RING_ENTRIES = atoi(optarg);
+      break;
+    case 'm':
+      USE_MMAP = true;
+      break;
+    case 'w':
+      WORK_STEALING = true;
+      break;
+    case 'e':
+      EVENT_LOOP = true;
+      break;
+    case 'a':
+      ASYNC_HANDLERS = true;
+      EVENT_LOOP = true;
+      break;
     default:
-      cerr<< "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers] [-i diskFile]" << endl;
+      cerr<< "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers] [-s FIFO|SFF|PRIORITY] [-i diskFile] [-g groupCommitMicros] [-c cacheBlocks] [-k keepAliveSeconds] [-r maxRequestsPerConnection] [-u ioRingEntries] [-m] [-w] [-e] [-a]" << endl;
       exit(1);
     }
   }
 
+  if (THREAD_POOL_SIZE < 1 || BUFFER_SIZE < 1) {
+    cerr << "threads and buffers must be at least 1" << endl;
+    exit(1);
+  }
+  if (KEEPALIVE_TIMEOUT < 0 || MAX_KEEPALIVE_REQUESTS < 1) {
+    cerr << "keep-alive timeout must be at least 0 and max requests at least 1" << endl;
+    exit(1);
+  }
+  if (SCHEDALG != "FIFO" && SCHEDALG != "SFF" && SCHEDALG != "PRIORITY") {
+    cerr << "scheduling policy must be FIFO, SFF or PRIORITY" << endl;
+    exit(1);
+  }
+
   set_log_file(LOGFILE);
 
   cout << "Listening on port " << PORT << endl;
@@ -164,15 +639,64 @@ int main(int argc, char *argv[]) {
   MyServerSocket *server = new MyServerSocket(PORT);
   MySocket *client;
 
+  Disk *disk = new Disk(DISKFILE, UFS_BLOCK_SIZE, USE_MMAP);
+  disk->setGroupCommitWindow(GROUP_COMMIT_WINDOW);
+  if (!USE_MMAP) {
+    disk->setCacheSize(CACHE_BLOCKS);
+  }
+  if (IO_RING_ENTRIES > 0 && !disk->setIoRing(IO_RING_ENTRIES)) {
+    cerr << "io_uring not available, using pread/pwrite" << endl;
+  }
+
+  LocalFileSystem *fileSystem = new LocalFileSystem(disk);
+
   // The order that you push services dictates the search order
   // for path prefix matching
-  services.push_back(new DistributedFileSystemService(DISKFILE));
+  services.push_back(new StatsService(fileSystem));
+  services.push_back(new DistributedFileSystemService(fileSystem));
   services.push_back(new FileService(BASEDIR));
+
+  // -w replaces the shared queue with one worker per core, each with its
+  // own queue, or -t workers spread over the cores. Handlers block on
+  // clients and on the disk, so more workers than cores can pay off.
+  // -b and -s do not apply to it
+  if (ASYNC_HANDLERS) {
+    // -a makes its own pool, below
+  } else if (WORK_STEALING) {
+    executor = new WorkStealingExecutor(THREAD_POOL_SIZE_SET ? THREAD_POOL_SIZE : 0, serve_connection);
+  } else {
+    for (int idx = 0; idx < THREAD_POOL_SIZE; idx++) {
+      pthread_t thread;
+      dthread_create(&thread, NULL, worker, NULL);
+      dthread_detach(thread);
+    }
+  }
   
+  // -e reads requests on an epoll loop and hands only complete ones to
+  // the workers, instead of a blocking accept and a worker per read. Idle
+  // kept-alive connections wait there too, without holding a worker, and
+  // so do requests while all -b slots are taken
+  //
+  // -a goes further and serves the requests as coroutines on the loop's
+  // thread. Only what blocks runs on the -t threads, which for a plain
+  // HttpService is each of its handlers. -b, -s and -w do not apply to it
+  if (ASYNC_HANDLERS) {
+    eventLoop = new EventLoop(server, PORT, start_request_async, KEEPALIVE_TIMEOUT, false);
+    scheduler = new EventLoopScheduler(eventLoop, THREAD_POOL_SIZE);
+    for (unsigned int idx = 0; idx < services.size(); idx++) {
+      AsyncHttpService *async = dynamic_cast<AsyncHttpService *>(services[idx]);
+      asyncServices.push_back(async != NULL ? async : new HttpServiceAdapter(services[idx]));
+    }
+    eventLoop->run();
+  } else if (EVENT_LOOP) {
+    eventLoop = new EventLoop(server, PORT, offer_connection, KEEPALIVE_TIMEOUT);
+    eventLoop->run();
+  }
+
   while(true) {
     sync_print("waiting_to_accept", "");
     client = server->accept();
     sync_print("client_accepted", "");
-    handle_request(client);
+    enqueue_connection(client, NULL, true);
   }
 }
@@ -0,0 +1,81 @@
+#ifndef ASYNC_HTTP_SERVICE_H_
+#define ASYNC_HTTP_SERVICE_H_
+
+#include "Coroutine.h"
+#include "HttpService.h"
+#include "HTTPRequest.h"
+#include "HTTPResponse.h"
+
+/**
+ * Sends a response to the client as it is produced, for a handler that
+ * has its body in a buffer of its own. The handler fills in the status and
+ * headers, co_awaits writeHead with the length of the body and then
+ * writeBody with exactly that many bytes, in one piece or several. A
+ * handler that does not call writeHead has its response sent once it
+ * returns. Both throw SocketWriteError if the client goes away.
+ */
+class ResponseWriter {
+ public:
+  virtual ~ResponseWriter() {}
+
+  virtual Task writeHead(HTTPResponse *response, long contentLength) = 0;
+  // data must stay valid until the write is done
+  virtual Task writeBody(const char *data, size_t length) = 0;
+};
+
+/**
+ * An HttpService whose handlers are coroutines, for gunrock_web -a.
+ *
+ * They run on the event loop's thread along with every other request in
+ * flight, so they must not block it: whatever waits, on the disk or
+ * anything else, is co_awaited through the scheduler, e.g. with blocking().
+ * A service that derives from both this and HttpService is served by
+ * these handlers with -a and by the synchronous ones otherwise.
+ */
+class AsyncHttpService {
+ public:
+  virtual ~AsyncHttpService() {}
+
+  // each one throws ClientError::methodNotAllowed() unless overridden
+  virtual Task head(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                    ResponseWriter *writer);
+  virtual Task get(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                   ResponseWriter *writer);
+  virtual Task put(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                   ResponseWriter *writer);
+  virtual Task post(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                    ResponseWriter *writer);
+  virtual Task del(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                   ResponseWriter *writer);
+  virtual Task move(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                    ResponseWriter *writer);
+};
+
+/**
+ * Serves a synchronous HttpService to the coroutines, running each of its
+ * handlers on one of the scheduler's blocking threads. A service with
+ * coroutines for only some of its handlers can derive from this too,
+ * adapting itself, and override just those.
+ */
+class HttpServiceAdapter : public AsyncHttpService {
+ public:
+  HttpServiceAdapter(HttpService *service);
+
+  virtual Task head(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                    ResponseWriter *writer);
+  virtual Task get(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                   ResponseWriter *writer);
+  virtual Task put(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                   ResponseWriter *writer);
+  virtual Task post(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                    ResponseWriter *writer);
+  virtual Task del(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                   ResponseWriter *writer);
+  virtual Task move(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                    ResponseWriter *writer);
+
+ private:
+  HttpService *m_service;
+};
+
+#endif
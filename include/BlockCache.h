@@ -0,0 +1,45 @@
+#ifndef _BLOCK_CACHE_H_
+#define _BLOCK_CACHE_H_
+
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A fixed-size cache of disk blocks with CLOCK (second chance) eviction.
+ *
+ * The cache only holds clean blocks, ones whose contents match what Disk
+ * has committed. Disk keeps uncommitted writes itself and hands them to
+ * the cache on commit.
+ */
+class BlockCache {
+ public:
+  BlockCache(int blockSize, int capacity);
+  ~BlockCache();
+
+  // copies the block into buffer and returns true if it is cached
+  bool lookup(int blockNumber, void *buffer);
+  // adds the block to the cache, or replaces the cached contents
+  void insert(int blockNumber, const void *buffer);
+  void invalidate(int blockNumber);
+
+  int capacity() { return m_capacity; }
+  unsigned long hits() { return m_hits; }
+  unsigned long misses() { return m_misses; }
+
+ private:
+  BlockCache(const BlockCache &);
+  BlockCache &operator=(const BlockCache &);
+
+  int m_blockSize;
+  int m_capacity;
+  unsigned char *m_frames;
+  // block number held by each frame, -1 if the frame is free
+  std::vector<int> m_frameBlocks;
+  std::vector<bool> m_referenced;
+  std::unordered_map<int, int> m_index;
+  int m_hand;
+  unsigned long m_hits;
+  unsigned long m_misses;
+};
+
+#endif
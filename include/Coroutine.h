@@ -0,0 +1,151 @@
+#ifndef _COROUTINE_H_
+#define _COROUTINE_H_
+
+#include <coroutine>
+#include <exception>
+
+/**
+ * Where coroutines get resumed. Coroutines live on one thread, and
+ * whatever they wait for finishes by posting a callback back to it.
+ */
+class CoroutineScheduler {
+ public:
+  typedef void (*Callback)(void *arg);
+
+  virtual ~CoroutineScheduler() {}
+
+  // runs callback(arg) on the coroutines' thread. Safe from any thread
+  virtual void post(Callback callback, void *arg) = 0;
+  // runs callback(arg) on a thread that may block, e.g. on the disk
+  virtual void postBlocking(Callback callback, void *arg) = 0;
+  // runs callback(arg) on the coroutines' thread once fd can be written
+  // without blocking, or has failed. From that thread only, one waiter per
+  // descriptor
+  virtual void whenWritable(int fd, Callback callback, void *arg) = 0;
+};
+
+// a CoroutineScheduler::Callback that resumes the coroutine whose
+// handle address is arg
+void resumeCoroutine(void *arg);
+
+/**
+ * A coroutine without a result.
+ *
+ * It starts when it is awaited, and the awaiting coroutine carries on
+ * once it is done, with its exception if it threw. detach() starts one
+ * that nobody awaits instead, it frees itself when it finishes and must
+ * not throw.
+ */
+class Task {
+ public:
+  struct promise_type;
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+    void await_resume() noexcept {}
+  };
+
+  struct promise_type {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    bool detached = false;
+
+    Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception();
+  };
+
+  struct Awaiter {
+    std::coroutine_handle<promise_type> handle;
+
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting);
+    void await_resume();
+  };
+
+  Task(Task &&other) noexcept;
+  ~Task();
+
+  Awaiter operator co_await();
+  void detach();
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+  Task(const Task &);
+  Task &operator=(const Task &);
+
+  std::coroutine_handle<promise_type> m_handle;
+};
+
+/**
+ * co_await blocking(scheduler, function) runs function() on one of the
+ * scheduler's blocking threads and resumes once it returns, rethrowing
+ * whatever it threw.
+ */
+template <typename Function>
+class BlockingCall {
+ public:
+  BlockingCall(CoroutineScheduler *scheduler, Function function) : m_scheduler(scheduler), m_function(function) {}
+
+  bool await_ready() { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    m_handle = handle;
+    m_scheduler->postBlocking(run, this);
+  }
+  void await_resume() {
+    if (m_exception) {
+      std::rethrow_exception(m_exception);
+    }
+  }
+
+ private:
+  static void run(void *arg) {
+    BlockingCall *call = static_cast<BlockingCall *>(arg);
+    try {
+      call->m_function();
+    } catch (...) {
+      call->m_exception = std::current_exception();
+    }
+    // the awaiting coroutine may be gone as soon as it resumes, this is
+    // the last use of call
+    call->m_scheduler->post(resumeCoroutine, call->m_handle.address());
+  }
+
+  CoroutineScheduler *m_scheduler;
+  Function m_function;
+  std::coroutine_handle<> m_handle;
+  std::exception_ptr m_exception;
+};
+
+template <typename Function>
+BlockingCall<Function> blocking(CoroutineScheduler *scheduler, Function function) {
+  return BlockingCall<Function>(scheduler, function);
+}
+
+/**
+ * co_await writable(scheduler, fd) resumes once fd can be written without
+ * blocking, or has failed so that the next write says why.
+ */
+class Writable {
+ public:
+  Writable(CoroutineScheduler *scheduler, int fd) : m_scheduler(scheduler), m_fd(fd) {}
+
+  bool await_ready() { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    m_scheduler->whenWritable(m_fd, resumeCoroutine, handle.address());
+  }
+  void await_resume() {}
+
+ private:
+  CoroutineScheduler *m_scheduler;
+  int m_fd;
+};
+
+inline Writable writable(CoroutineScheduler *scheduler, int fd) {
+  return Writable(scheduler, fd);
+}
+
+#endif
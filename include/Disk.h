@@ -1,31 +1,200 @@
 #ifndef _DISK_H_
 #define _DISK_H_
 
+#include <atomic>
 #include <string>
-#include <deque>
+#include <map>
+#include <vector>
 
-struct UndoRecord {
-  int blockNumber;
-  unsigned char *blockData;
-};
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "BlockCache.h"
+#include "IoRing.h"
+
+// blocks kept in memory by default, 4 MB with 4 KB blocks
+#define DEFAULT_CACHE_BLOCKS (1024)
 
 class Disk {
  public:
-  Disk(std::string imageFile, int blockSize);
+  // When a committed transaction becomes durable:
+  //   SYNC_EVERY_WRITE: commit() writes the new blocks straight to their
+  //     home locations and flushes them before returning
+  //   SYNC_ON_COMMIT: commit() appends the new blocks to the image's
+  //     journal with a single flush and writes them home lazily, when the
+  //     journal fills up. Images without a journal behave like
+  //     SYNC_EVERY_WRITE, with one flush per commit.
+  // A writeBlock outside of a transaction is a transaction of its own.
+  //
+  // A Disk can be shared by threads. One transaction is open at a time:
+  // beginTransaction waits until the current one commits or rolls back.
+  // Its writes are seen only by the thread that opened it until commit,
+  // other threads keep reading the committed contents meanwhile.
+  typedef enum {SYNC_EVERY_WRITE, SYNC_ON_COMMIT} DurabilityMode;
+
+  // useMmap maps the whole image into memory and serves blocks straight
+  // from the mapping instead of with pread/pwrite
+  Disk(std::string imageFile, int blockSize, bool useMmap = false);
+  ~Disk();
   void readBlock(int blockNumber, void *buffer);
+  // Read blockNumbers[i] into buffers[i] for `count` blocks, each buffer
+  // one block long. Blocks that are not in memory are read from the image
+  // in runs of adjacent block numbers, one preadv per run, or all runs
+  // submitted at once when the disk has an io_uring.
+  void readBlocks(int count, const int *blockNumbers, const struct iovec *buffers);
+  // the same for `count` consecutive blocks into one buffer
+  void readBlocks(int firstBlock, int count, void *buffer);
+  // Zero-copy read for mmapped disks: the current contents of the block,
+  // valid until the next write or commit. NULL if the disk is not mmapped.
+  const unsigned char *peekBlock(int blockNumber);
   void writeBlock(int blockNumber, void *buffer);
+  // Write buffers[i] to blockNumbers[i] for `count` blocks, as one
+  // transaction if there is no open one. Commit writes runs of adjacent
+  // blocks with one pwritev each.
+  void writeBlocks(int count, const int *blockNumbers, const struct iovec *buffers);
+  void writeBlocks(int firstBlock, int count, const void *buffer);
+  // Write blocks that nothing committed uses, ones the open transaction
+  // has just allocated, straight to the image instead of keeping them in
+  // memory until commit. They are not journaled: commit flushes them
+  // before anything that links them in, and after a rollback or a crash
+  // they are free blocks again. A block that the journal still has an
+  // older copy of is written like any other, replay would overwrite it.
+  void writeNewBlocks(int count, const int *blockNumbers, const struct iovec *buffers);
   int numberOfBlocks();
 
+  // Called by commit on the committing thread right before the
+  // transaction's blocks become visible to other threads, with publishing
+  // set, and again once they all are. With a journal the blocks are
+  // already durable by then, otherwise they are written in place and
+  // flushed in between.
+  typedef void (*PublishCallback)(void *arg, bool publishing);
+
   void beginTransaction();
-  void commit();
+  void commit(PublishCallback callback = NULL, void *arg = NULL);
   void rollback();
+  // whether the calling thread has the open transaction
+  bool inTransaction();
+  // Number of rollbacks so far. Anything cached above the disk that was
+  // derived from blocks written since the last check may be stale.
+  unsigned long rollbacks();
+
+  void setDurabilityMode(DurabilityMode mode);
+  // How long a flush waits for other committers so that they can share
+  // a single fdatasync. 0 (the default) flushes right away.
+  void setGroupCommitWindow(int microseconds);
+
+  // Do image I/O through an io_uring with room for `entries` operations:
+  // readBlocks submits all of its runs together, and commit writes its
+  // runs followed by a linked fdatasync as one batch. 0 goes back to
+  // pread/pwrite. False if the image is mmapped or the kernel has no
+  // io_uring. Call before the disk is shared between threads.
+  bool setIoRing(int entries);
+
+  // Size of the block cache that serves reads, in blocks. 0 turns it off.
+  void setCacheSize(int blocks);
+  unsigned long cacheHits();
+  unsigned long cacheMisses();
   
  private:
+  // we own imageFileDescriptor, so don't let copies close it out from under us
+  Disk(const Disk &);
+  Disk &operator=(const Disk &);
+
+  // copies the block if the transaction, the journal or the cache has it.
+  // Otherwise returns false with the cache generation to pass to cacheBlock
+  // once the block has been read from the image
+  bool readBlockFromMemory(int blockNumber, void *buffer, unsigned long *generation);
+  void cacheBlock(int blockNumber, const void *buffer, unsigned long generation);
+  // a run of blocks read through the io_uring, cached by its completion
+  struct ReadRun {
+    Disk *disk;
+    const int *blockNumbers;
+    const struct iovec *buffers;
+    int count;
+    unsigned long generation;
+  };
+  static void cacheReadRun(void *arg, int result);
+  bool ownsTransaction();
+  void commitPendingBlocks(PublishCallback callback, void *arg);
+  void writeBlockToImage(int blockNumber, void *buffer);
+  // with sync, the blocks are durable once it returns
+  void writeBlocksToImage(std::map<int, unsigned char *> &blocks, bool sync = false);
+  // runs the READ operations in one batch, exits unless each read all of
+  // its buffers
+  void readImageBatch(std::vector<IoRing::Operation> &reads);
+  // the same for WRITE operations, followed by a flush with sync
+  void writeImageBatch(std::vector<IoRing::Operation> &writes, bool sync);
+  void readImage(off_t offset, void *buffer, size_t length);
+  void readImageVectored(off_t offset, const struct iovec *buffers, int count);
+  void writeImage(off_t offset, const void *buffer, size_t length);
+  void syncImage();
+
+  // journal support, see the format description in Disk.cpp
+  void openJournal();
+  void recoverJournal();
+  bool appendToJournal();
+  void writeJournalSuper();
+  void checkpoint();
+  void releaseBlocks(std::map<int, unsigned char *> &blocks);
+
   std::string imageFile;
   int blockSize;
   int imageFileSize;
-  bool isInTransaction;
-  std::deque<struct UndoRecord> undoLog;
+  // opened once for the lifetime of the Disk and accessed with pread/pwrite,
+  // so there is no shared seek position between threads
+  int imageFileDescriptor;
+  bool isWritable;
+  // the whole image when the disk is mmapped, NULL otherwise
+  unsigned char *mappedImage;
+  // read by every thread to tell whether it owns the transaction
+  std::atomic<bool> isInTransaction;
+  unsigned long rollbackCount;
+  // held from beginTransaction to commit or rollback by transactionOwner
+  pthread_mutex_t transactionLock;
+  std::atomic<pthread_t> transactionOwner;
+  // new contents of the blocks written by the open transaction, only ever
+  // touched by its owner
+  std::map<int, unsigned char *> pendingBlocks;
+  // whether the open transaction wrote blocks with writeNewBlocks, which
+  // have to be flushed before the journal links them in
+  bool wroteNewBlocks;
+
+  // guards checkpointBlocks and blockCache, which readers on any thread
+  // look at, against the transaction owner changing them. I/O happens
+  // outside of it
+  pthread_mutex_t stateLock;
+  // bumped whenever committed contents change. A block read from the image
+  // is only cached if no commit happened since the read started, otherwise
+  // it might be older than what the commit put in the cache
+  unsigned long cacheGeneration;
+  // set while commit writes blocks in place. A block that misses the cache
+  // meanwhile might be read from the image before its new contents land,
+  // so nothing is cached until they have
+  bool writingInPlace;
+
+  // journal region from the superblock, journalLength is 0 if there is none
+  int journalAddress;
+  int journalLength;
+  // next free journal block, relative to journalAddress
+  int journalHead;
+  unsigned int journalSequence;
+  // committed to the journal but not yet written to their home location
+  std::map<int, unsigned char *> checkpointBlocks;
+
+  BlockCache *blockCache;
+  // NULL unless setIoRing turned it on
+  IoRing *ioRing;
+
+  DurabilityMode durabilityMode;
+  int groupCommitWindow;
+  // group commit state: each flush request takes a ticket and one leader
+  // issues the fdatasync for every ticket handed out before it started
+  pthread_mutex_t syncLock;
+  pthread_cond_t syncDone;
+  unsigned long syncRequested;
+  unsigned long syncCompleted;
+  bool syncInProgress;
 };
 
 #endif
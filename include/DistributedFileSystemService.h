@@ -2,19 +2,36 @@
 #define _DISTRIBUTEDFILESYSTEMSERVICE_H_
 
 #include "HttpService.h"
+#include "AsyncHttpService.h"
 #include "LocalFileSystem.h"
 
+#include <cstdio>
 #include <string>
+#include <vector>
 
-class DistributedFileSystemService : public HttpService {
+// With gunrock_web -a, GET runs as a coroutine of its own and the other
+// methods run their blocking handlers through the adapter
+class DistributedFileSystemService : public HttpService, public HttpServiceAdapter {
  public:
   DistributedFileSystemService(std::string driveFile);
+  // serve a file system that the caller already mounted, so that it can be
+  // shared with other services
+  DistributedFileSystemService(LocalFileSystem *fileSystem);
 
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void put(HTTPRequest *request, HTTPResponse *response);
+  virtual void post(HTTPRequest *request, HTTPResponse *response);
   virtual void del(HTTPRequest *request, HTTPResponse *response);
+  virtual long requestSize(HTTPRequest *request);
+
+  virtual Task get(CoroutineScheduler *scheduler, HTTPRequest *request, HTTPResponse *response,
+                   ResponseWriter *writer);
 
 private:
+  int createFile(const std::string &requestedPath, HTTPResponse *response);
+  int fileSize(const std::string &requestedPath);
+  long writeBody(int inodeId, int offset, bool replace, std::vector<char> &chunk, long length, FILE *spool);
+
   LocalFileSystem *fileSystem;
 };
 
@@ -0,0 +1,117 @@
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "MySocket.h"
+#include "MyServerSocket.h"
+#include "HTTPRequest.h"
+
+/**
+ * Accepts connections and reads their requests without blocking, on one
+ * thread, with epoll.
+ *
+ * Bytes are fed to the request's parser as they arrive. Only a request
+ * that isReady() is handed on, with its socket switched back to blocking
+ * so that the handler can read a streamed body and write the response the
+ * usual way. An idle or slow client
+ * costs a file descriptor and a parser, not a thread.
+ *
+ * The loop never waits on the handler either. One that has no room for a
+ * request turns it down, and the connection stays here, unread, until
+ * handlerReady() says to offer it again.
+ *
+ * A kept-alive connection comes back through resume() once its response
+ * is written, to wait here for the next request. Connections that send
+ * nothing for idleTimeout seconds are closed.
+ *
+ * Handlers that run on the loop's thread themselves, like the coroutines
+ * of -a, get their sockets left non-blocking, and can post() work to the
+ * loop and wait for a socket to take more with whenWritable().
+ */
+class EventLoop {
+ public:
+  // takes ownership of client and request, or returns false to leave them
+  // with the loop until handlerReady()
+  typedef bool (*RequestHandler)(MySocket *client, HTTPRequest *request);
+  typedef void (*Callback)(void *arg);
+
+  // idleTimeout of 0 never closes idle connections. blockingHandoff
+  // switches sockets back to blocking before they go to the handler
+  EventLoop(MyServerSocket *server, int serverPort, RequestHandler handler, int idleTimeout = 0,
+            bool blockingHandoff = true);
+
+  // never returns
+  void run();
+
+  // hand a connection back to wait for its next request, request having
+  // been reset() for it. Safe to call from any thread
+  void resume(MySocket *client, HTTPRequest *request);
+
+  // run callback(arg) on the loop's thread. Safe to call from any thread
+  void post(Callback callback, void *arg);
+
+  // offer the connections the handler turned down again, oldest first.
+  // Safe to call from any thread
+  void handlerReady();
+
+  // run callback(arg) on the loop's thread once fd can be written, or has
+  // failed. From the loop's thread only, for a descriptor it is not
+  // reading, one callback at a time
+  void whenWritable(int fd, Callback callback, void *arg);
+
+ private:
+  EventLoop(const EventLoop &);
+  EventLoop &operator=(const EventLoop &);
+
+  struct Connection {
+    MySocket *socket;
+    HTTPRequest *request;
+    time_t lastActive;
+  };
+
+  void acceptConnections();
+  void addConnection(MySocket *client, HTTPRequest *request);
+  void wakeUp();
+  void resumeConnections(std::vector<Connection> &resumed);
+  void runWriter(int fd);
+  void readFromConnection(int fd);
+  void handOff(Connection &connection);
+  void handOffParked();
+  void closeConnection(int fd);
+  void closeIdleConnections();
+
+  MyServerSocket *m_server;
+  int m_serverPort;
+  RequestHandler m_handler;
+  bool m_blockingHandoff;
+  int m_epollFd;
+  int m_idleTimeout;
+  // connections still reading a request, by file descriptor
+  std::unordered_map<int, Connection> m_connections;
+  // connections with a request that the handler turned down, oldest
+  // first. Their sockets are not watched until it takes them
+  std::deque<Connection> m_parked;
+
+  struct PendingCallback {
+    Callback callback;
+    void *arg;
+  };
+  // callbacks waiting for whenWritable(), by file descriptor
+  std::unordered_map<int, PendingCallback> m_writers;
+
+  // connections handed back by resume(), callbacks from post() and
+  // handlerReady() calls, and an eventfd that wakes the loop to pick them up
+  pthread_mutex_t m_resumeLock;
+  std::vector<Connection> m_resumed;
+  std::vector<PendingCallback> m_posted;
+  bool m_handlerReady;
+  int m_wakeFd;
+};
+
+#endif
@@ -11,6 +11,7 @@ class FileService : public HttpService {
 
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void head(HTTPRequest *request, HTTPResponse *response);
+  virtual long requestSize(HTTPRequest *request);
 
 private:
   bool endswith(std::string str, std::string suffix);
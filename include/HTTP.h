@@ -15,6 +15,11 @@ class HTTP {
     ~HTTP();
 
     int addData(const unsigned char *data, int len);
+    // forget the finished message and get ready to parse the next one on
+    // the same connection
+    void reset();
+    // whether the client wants the connection kept open after this message
+    bool shouldKeepAlive() {return m_keepAlive;}
     bool isDone();
     bool isHeaderDone();
     std::string getProxyRequest(const char *userAgent = NULL);
@@ -30,6 +35,11 @@ class HTTP {
     bool isDelete() {return m_method == HTTP_DELETE;}
     bool isMove() {return m_method == HTTP_MOVE;}
     std::string getBody();
+    // move up to size bytes of the body parsed so far into buffer, for
+    // bodies read a piece at a time. Returns how many there were
+    int takeBody(char *buffer, int size);
+    // from the Content-Length header, -1 without one
+    long getContentLength() {return m_contentLength;}
     std::string getQuery() {return m_query;}
     std::vector< std::pair< std::string *, std::string *> > getHeaders() {
       return m_headers;
@@ -61,6 +71,7 @@ class HTTP {
     HttpState m_state;
     bool m_doneParsing;
     bool m_headerDone;
+    bool m_keepAlive;
 
     std::string m_url;
     std::string m_path;
@@ -70,6 +81,7 @@ class HTTP {
     std::string *m_value;
     std::vector< std::pair< std::string *, std::string *> > m_headers;
     std::string m_body;
+    long m_contentLength;
     std::string m_statusStr;
     unsigned char m_method;
     http_parser_type m_httpType;
@@ -12,12 +12,47 @@
 #include <string>
 #include <vector>
 
+// how long readBody() waits for more of a body by default
+#define BODY_IDLE_TIMEOUT_MILLIS (10000)
+// how long reading a whole body may take, however steadily it trickles in
+#define BODY_TIMEOUT_MILLIS (600000)
+
 class HTTPRequest {
 public:
   HTTPRequest(MySocket *sock, int serverPort);
   ~HTTPRequest();
   
-  bool readRequest();
+  // Read until the request isReady(). With a timeout, give up when the
+  // client sends nothing for that many milliseconds, and with timeoutMillis
+  // when the whole request takes longer than that.
+  bool readRequest(int idleTimeoutMillis = -1, int timeoutMillis = -1);
+  // Parse bytes read from the client without blocking. Returns how many
+  // of them belong to this request, or -1 if they are not valid HTTP.
+  // Bytes past the end of the request are kept for the next one.
+  int addData(const char *buffer, unsigned int len);
+  bool isDone() {return m_http->isDone();}
+  // Whether a service can take the request: it is complete, or its headers
+  // are and its body is too long to buffer, or chunked. The service then
+  // reads that body with readBody() as it arrives.
+  bool isReady();
+
+  // Move up to size bytes of the body into buffer, reading from the client
+  // when none have arrived yet. Blocks, coroutines call it through
+  // blocking(). Returns 0 at the end of the body, -1 if the client goes
+  // away, sends nothing for idleTimeoutMillis or is still sending the body
+  // BODY_TIMEOUT_MILLIS after it was first read from.
+  int readBody(char *buffer, int size, int idleTimeoutMillis = BODY_IDLE_TIMEOUT_MILLIS);
+  // Read and drop whatever readBody() left of the body, so that the
+  // response can be sent and the next request read. False as readBody().
+  bool finishBody(int idleTimeoutMillis = BODY_IDLE_TIMEOUT_MILLIS);
+
+  // Move on to the next request on the same connection, once this one is
+  // done, parsing whatever the client already sent of the next. Returns
+  // false if that is not valid HTTP.
+  bool reset();
+  bool shouldKeepAlive() {return m_http->shouldKeepAlive();}
+  // how many requests this connection has carried, this one included
+  int requestCount() {return m_requestCount;}
 
   std::string getHost();
   std::string getRequest();
@@ -25,6 +60,8 @@ public:
   std::string getPath();
   std::vector<std::string> getPathComponents();
   std::string getHeader(std::string key);
+  // getHeader() ignoring case, as HTTP header names do. False without one
+  bool findHeader(std::string key, std::string &value);
   bool hasAuthToken();
   std::string getAuthToken();
   bool isConnect();
@@ -36,18 +73,32 @@ public:
   bool isMove() {return m_http->isMove();}
   std::map<std::string, std::string> getParams();
   WwwFormEncodedDict formEncodedBody();
-  std::string getBody() {return m_http->getBody();}
+  // The whole body, reading what is left of a streamed one first. Only
+  // what readBody() has not taken.
+  std::string getBody();
+  // from the Content-Length header, -1 without one
+  long getContentLength() {return m_http->getContentLength();}
   
   void printDebugInfo();
     
  protected:
-    void onRead(const char *buffer, unsigned int len);
+    // wait for the client and parse what it sends, false if it goes away
+    // or sends nothing for idleTimeoutMillis
+    bool readMore(int idleTimeoutMillis);
+    // readMore for the body, false once its BODY_TIMEOUT_MILLIS are up
+    bool readMoreBody(int idleTimeoutMillis);
 
     MySocket *m_sock;
     HTTP *m_http;
     int m_serverPort;
     unsigned long m_totalBytesRead;
     unsigned long m_totalBytesWritten;
+    // bytes of pipelined requests that arrived with this one
+    std::string m_pending;
+    int m_requestCount;
+    // when reading the body gives up, in CLOCK_MONOTONIC milliseconds. 0
+    // until the body is first read from
+    long long m_bodyDeadline;
 };
 
 #endif
@@ -10,6 +10,9 @@ class HTTPResponse {
   void withStreaming();
   void setHeader(std::string name, std::string value);
   void setBody(std::string data);
+  // for a body that is written to the client separately: response() then
+  // announces length bytes and leaves the body out
+  void setContentLength(long length);
   void setContentType(std::string contentType);
   void setStatus(int status);
   int getStatus();
@@ -22,6 +25,8 @@ class HTTPResponse {
   bool streaming;
   std::map<std::string, std::string> headers;
   std::string body;
+  // -1 unless setContentLength was called
+  long contentLength;
   std::string contentType;
 };
 
@@ -19,6 +19,12 @@ class HttpService {
   virtual void post(HTTPRequest *request, HTTPResponse *response);
   virtual void del(HTTPRequest *request, HTTPResponse *response);
   virtual void move(HTTPRequest *request, HTTPResponse *response);
+
+  // Roughly how many bytes serving this request moves, for shortest-first
+  // scheduling. It must be cheap, the acceptor calls it for every request.
+  // The default is the request's Content-Length, so that a streamed body
+  // is not read for it.
+  virtual long requestSize(HTTPRequest *request);
   
  private:
   std::string m_pathPrefix;
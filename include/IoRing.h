@@ -0,0 +1,104 @@
+#ifndef _IO_RING_H_
+#define _IO_RING_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+/**
+ * An io_uring: a queue of reads, writes and flushes that the kernel works
+ * through asynchronously, with their results coming back on a second queue.
+ *
+ * Talks to the kernel with the raw system calls, so nothing beyond the
+ * kernel headers is needed. Any number of threads can share one ring.
+ * Each submit() hands its operations to the kernel together and in order,
+ * and a linked operation only starts once the one before it has succeeded.
+ * Completions are reaped by one waiting thread at a time, which runs the
+ * callback of every operation it finds done, its own or another thread's.
+ */
+class IoRing {
+ public:
+  // called once an operation is done with what the system call would have
+  // returned, bytes transferred or -errno. Runs on whichever thread reaps
+  // the completion and must not use the ring itself
+  typedef void (*Callback)(void *arg, int result);
+
+  typedef enum {READ, WRITE, DATA_SYNC} OperationType;
+
+  struct Operation {
+    OperationType type;
+    int fd;
+    // READ and WRITE only
+    const struct iovec *buffers;
+    int count;
+    off_t offset;
+    // start the next operation only if this one succeeds, cancel it with
+    // -ECANCELED otherwise
+    bool link;
+    // may be NULL
+    Callback callback;
+    void *arg;
+
+    // filled in on completion
+    int result;
+    bool done;
+  };
+
+  // a ring with room for `entries` queued operations, NULL if the kernel
+  // does not offer io_uring
+  static IoRing *open(unsigned int entries);
+  ~IoRing();
+
+  // Submits `count` operations and waits until all of them are done. More
+  // operations than the ring holds go in several rounds, each waiting for
+  // the one before, which keeps linked ones in order. Returns 0, or the
+  // first negative result among them
+  int run(Operation *operations, int count);
+
+  // Submits without waiting. At most entries() operations, which must stay
+  // valid until wait() says they are done
+  void submit(Operation *operations, int count);
+  void wait(Operation *operations, int count);
+
+  unsigned int entries() { return m_entries; }
+
+ private:
+  IoRing(int fd, struct io_uring_params &params);
+  IoRing(const IoRing &);
+  IoRing &operator=(const IoRing &);
+
+  int enter(unsigned int toSubmit, unsigned int minComplete, unsigned int flags);
+  // runs the callbacks of everything on the completion queue, returns how
+  // many there were. Called with m_completionLock held
+  int reapCompletions();
+
+  int m_fd;
+  unsigned int m_entries;
+
+  // the submission queue, shared with the kernel, and the slots it indexes
+  void *m_sqRing;
+  size_t m_sqRingSize;
+  unsigned int *m_sqHead;
+  unsigned int *m_sqTail;
+  unsigned int *m_sqMask;
+  unsigned int *m_sqArray;
+  struct io_uring_sqe *m_sqes;
+  size_t m_sqesSize;
+  pthread_mutex_t m_submitLock;
+
+  // the completion queue. Only one thread at a time reaps or sleeps in the
+  // kernel waiting for it, the others wait for that one to wake them
+  void *m_cqRing;
+  size_t m_cqRingSize;
+  unsigned int *m_cqHead;
+  unsigned int *m_cqTail;
+  unsigned int *m_cqMask;
+  struct io_uring_cqe *m_cqes;
+  pthread_mutex_t m_completionLock;
+  pthread_cond_t m_completed;
+  bool m_reaping;
+};
+
+#endif
@@ -1,7 +1,12 @@
 #ifndef _LOCAL_FILE_SYSTEM_H_
 #define _LOCAL_FILE_SYSTEM_H_
 
+#include <atomic>
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <pthread.h>
 
 #include "Disk.h"
 #include "ufs.h"
@@ -17,6 +22,14 @@
  * callers operate will not align on disk block boundaries, so your job is
  * to manage the interactions with the underlying storage to provide a higher
  * level of abstraction for any code that uses this class.
+ *
+ * Any number of threads can use one LocalFileSystem. Calls that change the
+ * file system run in transactions, one at a time, see Disk. lookup, stat
+ * and read take no locks: every inode has a sequence counter that a
+ * commit makes odd while it publishes the inode or its blocks and even
+ * again once they are all visible. A reader notes the counter, reads, and
+ * tries again if the counter moved, so it never sees half of a transaction
+ * and readers only ever load shared cache lines.
  */
 
 // Note: If a function invocation has more than one error, return
@@ -44,9 +57,29 @@
 // Unlinking '.' or '..'
 #define EUNLINKNOTALLOWED  (10)
 
+// times a reader yields while a commit publishes the inode it wants
+// before it sleeps until the commit is done instead
+#define PUBLISH_SPINS (16)
+
+// slots of the dentry cache, a newer lookup takes over its slot
+#define DENTRY_CACHE_ENTRIES (8192)
+
 class LocalFileSystem {
  public:
   LocalFileSystem(Disk *disk);
+  ~LocalFileSystem();
+
+  /**
+   * Transactions.
+   *
+   * Changes made between beginTransaction and commit become durable and
+   * visible to other threads together, or not at all with rollback. A
+   * call that changes the file system outside of a transaction is a
+   * transaction of its own, committed if it succeeds.
+   */
+  void beginTransaction();
+  void commit();
+  void rollback();
   /**
    * Lookup an inode.
    *
@@ -100,6 +133,27 @@ class LocalFileSystem {
    */
   int write(int inodeNumber, const void *buffer, int size);
 
+  /**
+   * Write size bytes of buffer at offset, like pwrite.
+   *
+   * Only the blocks in [offset, offset + size) are written, plus zeroed
+   * new blocks when the write starts past the end of the file. The file
+   * grows if the write ends past its end and never shrinks.
+   *
+   * Success: number of bytes written, fewer than size if the disk is full
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EINVALIDTYPE.
+   */
+  int write(int inodeNumber, const void *buffer, int size, int offset);
+
+  /**
+   * Set the size of a regular file. Shrinking frees the blocks past the
+   * new end, growing adds zeroes.
+   *
+   * Success: 0
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EINVALIDTYPE, -ENOTENOUGHSPACE.
+   */
+  int truncate(int inodeNumber, int size);
+
   /**
    * Read the contents of a file or directory.
    *
@@ -113,6 +167,15 @@ class LocalFileSystem {
    */
   int read(int inodeNumber, void *buffer, int size);
 
+  /**
+   * Read up to size bytes starting at offset, like pread. Only the blocks
+   * holding that range are read.
+   *
+   * Success: number of bytes read, 0 at or past the end of the file
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE.
+   */
+  int read(int inodeNumber, void *buffer, int size, int offset);
+
   /**
    * Remove a file or directory.
    *
@@ -126,12 +189,23 @@ class LocalFileSystem {
    * existing is NOT a failure by our definition. You can't unlink '.' or '..'
    */
   int unlink(int parentInodeNumber, std::string name);
+
+  /**
+   * Free space summary.
+   *
+   * The number of unallocated inodes and data blocks. Both are counted from
+   * the bitmaps at mount and kept up to date by every allocation and free,
+   * so asking is constant time and takes no locks. They include the
+   * changes of a transaction that has not committed yet.
+   */
+  int freeInodeCount();
+  int freeDataBlockCount();
   
   /**
    * Some helper functions that you need to implement and use in your
-   * implementation of the higher-level functions. When you operate on
-   * file system metadata, you must read/write the entire structure instead
-   * of trying to identify individual disk blocks and accessing only these.
+   * implementation of the higher-level functions. Bitmaps are read and
+   * written as a whole, inodes are accessed one at a time through
+   * readInode/writeInode so that only the block holding them is touched.
    */
   void readSuperBlock(super_t *super);
 
@@ -143,10 +217,135 @@ class LocalFileSystem {
   void readInodeRegion(super_t *super, inode_t *inodes);
   void writeInodeRegion(super_t *super, inode_t *inodes);
 
+  // Read/write a single inode, touching only the inode region block that holds it
+  void readInode(super_t *super, int inodeNumber, inode_t *inode);
+  void writeInode(super_t *super, int inodeNumber, inode_t *inode);
+
+  // Disk addresses of the first `count` data blocks of a file, in order.
+  // Each indirect block is read once, so walking a whole file is cheap.
+  // Returns 0, or -1 if the file's block map is damaged.
+  int fileBlocks(inode_t *inode, int count, std::vector<unsigned int> &blocks);
+
   // Normally we'd mark this as private but we expose it so that you can access
   // it in a function you add that is not part of the LocalFileSystem object but
   // can still access the disk.
   Disk *disk;
+
+  // The superblock and the geometry derived from it, loaded and validated
+  // once by the constructor since they never change at runtime. Read-only.
+  super_t superBlock;
+  int inodesPerBlock;       // inodes in one block of the inode region
+  int inodeRegionCapacity;  // inodes that fit in the inode region
+  int inodeBitmapSize;      // bytes, whole blocks
+  int dataBitmapSize;       // bytes, whole blocks
+  int directPointers;       // slots of inode_t.direct that hold data blocks, 0 for extents
+  int maxFileBlocks;        // largest file the format can hold, in blocks
+  int maxFileSize;          // and in bytes
+
+  // Next-fit hints for the allocator: searches for a free inode or data block
+  // start here instead of at bit 0. Only a hint, any value is safe. Only
+  // the open transaction allocates, so they need no lock.
+  int nextFreeInode;
+  int nextFreeData;
+
+ private:
+  // recount the free counters from the on-disk bitmaps
+  void countFreeSpace();
+  // commit or roll back the transaction a call started for itself
+  int finishTransaction(int result);
+
+  // stat and read inside a reader's sequence check, or for the transaction
+  int statInode(int inodeNumber, inode_t *inode);
+  int readInodeData(int inodeNumber, void *buffer, int size, int offset);
+  int lookupEntry(int parentInodeNumber, const std::string &name, unsigned int version);
+
+  // Sequence counters. beginRead waits out a commit in progress and returns
+  // the counter, endRead tells whether the inode stayed the same since.
+  // Both always succeed for the transaction's own thread, nobody else
+  // commits while it is open
+  unsigned int beginRead(int inodeNumber);
+  bool endRead(int inodeNumber, unsigned int version);
+  std::atomic<unsigned int> *inodeVersions;
+
+  // The Disk::PublishCallback for commit. The counters of the changed
+  // inodes are odd only from beginPublish to endPublish, after a journaled
+  // commit is durable, so readers don't wait out its flush. Readers that
+  // find one odd for long sleep on published until endPublish
+  static void publishCommit(void *arg, bool publishing);
+  void beginPublish();
+  void endPublish();
+  pthread_mutex_t publishLock;
+  pthread_cond_t published;
+
+  // The inodes the open transaction changed, their counters move when it
+  // commits. Only ever touched by the thread that owns the transaction
+  bool changedInTransaction(int inodeNumber);
+  void markChanged(int inodeNumber);
+  std::vector<int> transactionInodes;
+  // held from beginTransaction until commit has evened the counters out,
+  // so that the next transaction never sees one of them odd
+  pthread_mutex_t transactionLock;
+
+  // In-memory hash index of a directory's entries, name to inode number.
+  // Built on the first lookup or create in a directory, for the version of
+  // it that its sequence counter had then. findEntry returns the entry's
+  // inode number or -ENOTFOUND. The open transaction keeps its changes to
+  // the entries aside in transactionEntries, -ENOTFOUND for removed ones,
+  // and commit applies them to the shared index
+  typedef std::unordered_map<std::string, int> DirectoryIndex;
+  struct VersionedIndex {
+    unsigned int version;
+    DirectoryIndex entries;
+  };
+  int findEntry(int inodeNumber, inode_t *inode, const std::string &name, unsigned int version);
+  std::unordered_map<int, VersionedIndex> directoryIndexes;
+  pthread_rwlock_t indexLock;
+  std::unordered_map<int, DirectoryIndex> transactionEntries;
+
+  // Dentry cache: the result of lookup(parent, name), either the child's
+  // inode number or -ENOTFOUND, for one version of the parent. A hit needs
+  // no disk access and no lock, not even a stat of the parent. A commit
+  // that changes the parent moves its counter, which retires all its
+  // entries at once. Slots are picked by hash and have sequence counters
+  // of their own, a writer that finds a slot busy just skips caching
+  struct Dentry {
+    std::atomic<unsigned int> sequence;
+    int parent;
+    unsigned int parentVersion;
+    int inodeNumber;
+    char name[DIR_ENT_NAME_SIZE];
+  };
+  bool findDentry(int parent, const std::string &name, unsigned int parentVersion, int *inodeNumber);
+  void insertDentry(int parent, const std::string &name, unsigned int parentVersion, int inodeNumber);
+  Dentry *dentries;
+
+  // Grow or shrink a file's block map to `count` data blocks, allocating
+  // and freeing data and indirect blocks in dataBitmap and writing out the
+  // indirect blocks. Fills `blocks` with the data block addresses and
+  // returns how many there are, fewer than asked for if the disk is full.
+  int resizeFile(inode_t *inode, int count, unsigned char *dataBitmap, std::vector<unsigned int> &blocks);
+  int indirectBlocksFor(int count);
+  // encode a version 2 block map, dropping the blocks that do not fit
+  int setExtents(inode_t *inode, unsigned char *dataBitmap, std::vector<unsigned int> &blocks);
+  unsigned int allocateIndirectBlock(unsigned char *dataBitmap);
+  void freeDataBlock(unsigned char *dataBitmap, unsigned int address);
+  void writeIndirectBlock(unsigned int address, const std::vector<unsigned int> &blocks, int first);
+  // 0 if every address is in the data region, -1 otherwise
+  int checkDataBlocks(const std::vector<unsigned int> &blocks);
+
+  std::atomic<int> freeInodes;
+  std::atomic<int> freeDataBlocks;
+  // their values when the open transaction began, for rollback
+  int committedFreeInodes;
+  int committedFreeDataBlocks;
+
+  // Data blocks that the open transaction allocated and that were free when
+  // it began, which write() hands to Disk::writeNewBlocks, and the blocks
+  // it freed that were in use then. Those still hold what readers see
+  // until it commits, so resizeFile allocates them only when nothing else
+  // is free. Only ever touched by the thread that owns the transaction
+  std::unordered_set<unsigned int> transactionNewBlocks;
+  std::unordered_set<unsigned int> transactionFreedBlocks;
 };  
 
 #endif
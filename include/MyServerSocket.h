@@ -23,6 +23,13 @@ class MyServerSocket {
    */
   MySocket *accept();
 
+  /**
+   * the same for a non-blocking server socket: NULL when there is no
+   * connection waiting. Sockets it returns are non-blocking too
+   */
+  MySocket *tryAccept();
+  void setNonBlocking();
+
   int getFd() { return serverFd; }
  protected:
   int serverFd;
@@ -0,0 +1,20 @@
+#ifndef _STATSSERVICE_H_
+#define _STATSSERVICE_H_
+
+#include "HttpService.h"
+#include "LocalFileSystem.h"
+
+#include <string>
+
+// Serves a plain text summary of the file system on GET /stats
+class StatsService : public HttpService {
+ public:
+  StatsService(LocalFileSystem *fileSystem);
+
+  virtual void get(HTTPRequest *request, HTTPResponse *response);
+
+private:
+  LocalFileSystem *fileSystem;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef _WORK_STEALING_EXECUTOR_H_
+#define _WORK_STEALING_EXECUTOR_H_
+
+#include <pthread.h>
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+/**
+ * A fixed set of worker threads, one per core, each with its own queue.
+ *
+ * submit() puts work on the queue of the worker pinned to the core the
+ * caller is running on, so it tends to run where it was produced. A
+ * worker serves its own queue oldest first. When that is empty it steals
+ * the newest item from another worker's queue, and sleeps only after a
+ * sweep over every queue comes up empty. Each queue has its own lock, so
+ * workers do not contend with each other unless they steal.
+ */
+class WorkStealingExecutor {
+ public:
+  typedef void (*Task)(void *arg);
+
+  // start `workers` threads, or one per online core if workers < 1, that
+  // run task(arg) for every submitted arg
+  WorkStealingExecutor(int workers, Task task);
+
+  void submit(void *arg);
+  // the same, onto a given worker's queue
+  void submitTo(int worker, void *arg);
+
+  int workers() { return (int) m_workers.size(); }
+  unsigned long steals() { return m_steals.load(); }
+
+ private:
+  WorkStealingExecutor(const WorkStealingExecutor &);
+  WorkStealingExecutor &operator=(const WorkStealingExecutor &);
+
+  struct Worker {
+    WorkStealingExecutor *executor;
+    int index;
+    int cpu;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    std::deque<void *> items;
+    // items.size(), readable without the lock
+    std::atomic<int> queued;
+    bool sleeping;
+  };
+
+  static void *run(void *arg);
+  bool take(Worker *worker, void **arg);
+  bool steal(Worker *thief, void **arg);
+  void wakeIdleWorker(Worker *except);
+
+  Task m_task;
+  std::vector<Worker *> m_workers;
+  // the worker pinned to each cpu, -1 for cpus without one
+  std::vector<int> m_cpuWorkers;
+  std::atomic<int> m_sleepers;
+  // workers that are awake and sweeping the other queues for work
+  std::atomic<int> m_searching;
+  std::atomic<unsigned long> m_steals;
+  std::atomic<unsigned int> m_nextWorker;
+};
+
+#endif
@@ -12,6 +12,34 @@
 
 #define MAX_FILE_SIZE (DIRECT_PTRS * UFS_BLOCK_SIZE)
 
+// On-disk format versions, recorded in super_t.version. Images made before
+// the field existed have zeros there and read back as version 0.
+#define UFS_VERSION_DIRECT   (0) // all DIRECT_PTRS pointers are data blocks
+#define UFS_VERSION_INDIRECT (1) // the last two pointers are indirect blocks
+#define UFS_VERSION_EXTENT   (2) // the pointers are pairs forming extents
+
+// Version 1 inodes use the last two slots of direct[] for a single-indirect
+// and a double-indirect block, 0 when the file does not need them. An
+// indirect block is an array of PTRS_PER_BLOCK data block addresses, a
+// double-indirect block an array of addresses of indirect blocks.
+#define NUM_DIRECT_INDIRECT (DIRECT_PTRS - 2)
+#define INDIRECT_PTR (DIRECT_PTRS - 2)
+#define DOUBLE_INDIRECT_PTR (DIRECT_PTRS - 1)
+#define PTRS_PER_BLOCK (UFS_BLOCK_SIZE / 4)
+
+// the pointers reach further than this, but inode_t.size is an int
+#define MAX_FILE_SIZE_INDIRECT (0x7fffffff / UFS_BLOCK_SIZE * UFS_BLOCK_SIZE)
+
+// Version 2 inodes read direct[] as NUM_EXTENTS extents, runs of adjacent
+// data blocks in file order. Unused extents have length 0. A file is
+// limited by the size field like version 1, and also by how many runs its
+// blocks are in.
+#define NUM_EXTENTS (DIRECT_PTRS / 2)
+typedef struct {
+    unsigned int start;   // first block address
+    unsigned int length;  // in blocks
+} extent_t;
+
 // Note: Bitmap indexes identify disk blocks relative to the start of a region.
 
 typedef struct {
@@ -38,6 +66,9 @@ typedef struct __super {
     int data_region_len;   // in blocks
     int num_inodes;        // just the number of inodes
     int num_data;          // and data blocks...
+    int journal_addr;      // block address (in blocks), see Disk.cpp
+    int journal_len;       // in blocks, 0 if the image has no journal
+    int version;           // one of the UFS_VERSION_ formats
 } super_t;
 
 
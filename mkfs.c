@@ -8,7 +8,7 @@
 #include "ufs.h"
 
 void usage() {
-    fprintf(stderr, "usage: mkfs -f <image_file> [-d <num_data_blocks] [-i <num_inodes>]\n");
+    fprintf(stderr, "usage: mkfs -f <image_file> [-d <num_data_blocks] [-i <num_inodes>] [-j <num_journal_blocks>] [-V <format_version>]\n");
     exit(1);
 }
 
@@ -17,9 +17,11 @@ int main(int argc, char *argv[]) {
     char *image_file = NULL;
     int num_inodes = 32;
     int num_data = 32;
+    int num_journal = 0;
+    int version = UFS_VERSION_INDIRECT;
     int visual = 0;
 
-    while ((ch = getopt(argc, argv, "i:d:f:v")) != -1) {
+    while ((ch = getopt(argc, argv, "i:d:f:j:V:v")) != -1) {
 	switch (ch) {
 	case 'i':
 	    num_inodes = atoi(optarg);
@@ -30,6 +32,12 @@ int main(int argc, char *argv[]) {
 	case 'f':
 	    image_file = optarg;
 	    break;
+	case 'j':
+	    num_journal = atoi(optarg);
+	    break;
+	case 'V':
+	    version = atoi(optarg);
+	    break;
 	case 'v':
 	    visual = 1;
 	    break;
@@ -58,6 +66,8 @@ int main(int argc, char *argv[]) {
 
     assert(num_inodes >= 32);
     assert(num_data >= 32);
+    assert(num_journal == 0 || num_journal >= 2);
+    assert(version == UFS_VERSION_DIRECT || version == UFS_VERSION_INDIRECT || version == UFS_VERSION_EXTENT);
 
     // presumed: block 0 is the super block
     super_t s;
@@ -91,7 +101,13 @@ int main(int argc, char *argv[]) {
     s.data_region_addr = s.inode_region_addr + s.inode_region_len;
     s.data_region_len = num_data;
 
-    int total_blocks = 1 + s.inode_bitmap_len + s.data_bitmap_len + s.inode_region_len + s.data_region_len;
+    // journal (optional), after everything else so the layout above does not change
+    s.journal_addr = (num_journal > 0) ? s.data_region_addr + s.data_region_len : 0;
+    s.journal_len = num_journal;
+
+    s.version = version;
+
+    int total_blocks = 1 + s.inode_bitmap_len + s.data_bitmap_len + s.inode_region_len + s.data_region_len + s.journal_len;
 
     // super block is the first block
     int rc = pwrite(fd, &s, sizeof(super_t), 0);
@@ -103,9 +119,12 @@ int main(int argc, char *argv[]) {
     printf("total blocks        %d\n", total_blocks);
     printf("  inodes            %d [size of each: %lu]\n", num_inodes, sizeof(inode_t));
     printf("  data blocks       %d\n", num_data);
+    printf("  format version    %d\n", s.version);
     printf("layout details\n");
     printf("  inode bitmap address/len %d [%d]\n", s.inode_bitmap_addr, s.inode_bitmap_len);
     printf("  data bitmap address/len  %d [%d]\n", s.data_bitmap_addr, s.data_bitmap_len);
+    if (s.journal_len > 0)
+	printf("  journal address/len      %d [%d]\n", s.journal_addr, s.journal_len);
 
     // first, zero out all the blocks
     int i;
@@ -152,8 +171,12 @@ int main(int argc, char *argv[]) {
     itable.inodes[0].type = UFS_DIRECTORY;
     itable.inodes[0].size = 2 * sizeof(dir_ent_t); // in bytes
     itable.inodes[0].direct[0] = s.data_region_addr;
+    // version 1 needs the indirect pointers to be 0 while they are unused
     for (i = 1; i < DIRECT_PTRS; i++)
-	itable.inodes[0].direct[i] = -1;
+	itable.inodes[0].direct[i] = (version == UFS_VERSION_DIRECT) ? -1 : 0;
+    // and version 2 reads the first two as the extent (data_region_addr, 1)
+    if (version == UFS_VERSION_EXTENT)
+	itable.inodes[0].direct[1] = 1;
 
     rc = pwrite(fd, &itable, UFS_BLOCK_SIZE, s.inode_region_addr * UFS_BLOCK_SIZE);
     assert(rc == UFS_BLOCK_SIZE);
@@ -193,6 +216,8 @@ int main(int argc, char *argv[]) {
 	    printf("I");
 	for (i = 0; i < s.data_region_len; i++)
 	    printf("D");
+	for (i = 0; i < s.journal_len; i++)
+	    printf("J");
 	printf("\n\n");
     }
 
@@ -5,7 +5,9 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdlib.h>
 
+#include <algorithm>
 #include <sstream>
 
 using namespace std;
@@ -18,21 +20,15 @@ HTTPClientResponse::HTTPClientResponse(MySocket *sock) {
 
 string HTTPClientResponse::readResponse() {
   string full_response;
+  size_t delimiter;
 
-  while (true) {
-    string response;
+  // the connection may stay open, so read only as far as the headers go
+  while ((delimiter = full_response.find("\r\n\r\n")) == string::npos) {
     try {
-      response = m_sock->read();
+      full_response += m_sock->read();
     } catch (...) {
-      break;
+      return "";
     }
-
-    full_response += response;
-  }
-
-  size_t delimiter = full_response.find("\r\n\r\n");
-  if (delimiter == string::npos) {
-    return "";
   }
 
   m_body = full_response.substr(delimiter+4);
@@ -41,12 +37,61 @@ string HTTPClientResponse::readResponse() {
 
   string line;
   while (getline(header_stream, line)) {
+    if (line.size() > 0 && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
     if (line.find("HTTP/1.1 ") == 0 || line.find("HTTP/1.0") == 0) {
       stringstream header_line(line);
-      string http;
-      header_line >> http >> m_status_code >> m_status_message;
+      header_line >> m_http_version >> m_status_code >> m_status_message;
+    } else {
+      size_t colon = line.find(':');
+      if (colon == string::npos) {
+        continue;
+      }
+      string name = line.substr(0, colon);
+      transform(name.begin(), name.end(), name.begin(), ::tolower);
+      size_t start = line.find_first_not_of(" \t", colon + 1);
+      m_headers[name] = start == string::npos ? "" : line.substr(start);
+    }
+  }
+
+  string length = header("content-length");
+  if (length != "") {
+    size_t expected = strtoul(length.c_str(), NULL, 10);
+    while (m_body.size() < expected) {
+      try {
+        m_body += m_sock->read();
+      } catch (...) {
+        break;
+      }
+    }
+    m_body.resize(min(m_body.size(), expected));
+  } else {
+    while (true) {
+      try {
+        m_body += m_sock->read();
+      } catch (...) {
+        break;
+      }
     }
   }
   
   return m_body;
 }
+
+string HTTPClientResponse::header(string name) {
+  map<string, string>::iterator iter = m_headers.find(name);
+  if (iter == m_headers.end()) {
+    return "";
+  }
+  return iter->second;
+}
+
+bool HTTPClientResponse::keepAlive() {
+  string connection = header("connection");
+  transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+  if (m_status_code == 0 || header("content-length") == "" || connection == "close") {
+    return false;
+  }
+  return m_http_version == "HTTP/1.1" || connection == "keep-alive";
+}
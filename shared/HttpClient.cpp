@@ -17,13 +17,16 @@ HttpClient::HttpClient(const char *inet_addr, int port, bool use_tls) {
   } else {
     connection = new MySocket(inet_addr, port);
   }
+  this->address = inet_addr;
+  this->port = port;
+  reused = false;
   
   stringstream host;
   host << inet_addr << ":" << port;
   headers["Host"] = host.str();
   headers["User-Agent"] = string("Gunrock/1.0");
   headers["Accept"] = string("*/*");
-  headers["Connection"] = string("close");
+  headers["Connection"] = string("keep-alive");
 }
 
 HttpClient::~HttpClient() {
@@ -65,6 +68,10 @@ void HttpClient::write_request(string path, string method, string body) {
     request << body;
   }
   
+  if (connection == NULL) {
+    connection = new MySocket(address.c_str(), port);
+    reused = false;
+  }
   connection->write(request.str());
 }
 
@@ -73,25 +80,50 @@ void HttpClient::write_request(string path, string method, string body) {
 HTTPClientResponse *HttpClient::read_response() {
   HTTPClientResponse *response = new HTTPClientResponse(connection);
   response->readResponse();
+  reused = true;
+  if (!response->keepAlive()) {
+    // the next request needs a new connection
+    delete connection;
+    connection = NULL;
+  }
   return response;
 }
 
-HTTPClientResponse *HttpClient::get(string path) {
-  write_request(path, "GET", "");
+HTTPClientResponse *HttpClient::send_request(string path, string method, string body) {
+  // the server may have closed an idle connection just as we reused it,
+  // which shows up as a failed write or no response at all. Try once more
+  // on a fresh connection
+  bool retry = connection != NULL && reused;
+  try {
+    write_request(path, method, body);
+    HTTPClientResponse *response = read_response();
+    if (response->status() != 0 || !retry) {
+      return response;
+    }
+    delete response;
+  } catch (SocketWriteError &e) {
+    if (!retry) {
+      throw;
+    }
+  }
+  delete connection;
+  connection = NULL;
+  write_request(path, method, body);
   return read_response();
 }
 
+HTTPClientResponse *HttpClient::get(string path) {
+  return send_request(path, "GET", "");
+}
+
 HTTPClientResponse *HttpClient::post(string path, string body) {
-  write_request(path, "POST", body);
-  return read_response();
+  return send_request(path, "POST", body);
 }
 
 HTTPClientResponse *HttpClient::put(string path, string body) {
-  write_request(path, "PUT", body);
-  return read_response();
+  return send_request(path, "PUT", body);
 }
 
 HTTPClientResponse *HttpClient::del(string path) {
-  write_request(path, "DELETE", "");
-  return read_response();
+  return send_request(path, "DELETE", "");
 }
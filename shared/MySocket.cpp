@@ -2,6 +2,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <string.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -80,6 +82,25 @@ void MySocket::write_bytes(const void *buffer, int len) {
     }
 }
 
+int MySocket::write_some(const void *buffer, int len) {
+    if (sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    while (true) {
+        int bytesWritten = ::write(sockFd, buffer, len);
+        if (bytesWritten >= 0) {
+            return bytesWritten;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            throw SocketWriteError();
+        }
+    }
+}
+
 string MySocket::read() {
     char buffer[4096];
     if(sockFd<0) {
@@ -95,6 +116,22 @@ string MySocket::read() {
     return string(buffer, ret);
 }
 
+void MySocket::setNonBlocking(bool nonBlocking) {
+    if(sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    int flags = fcntl(sockFd, F_GETFL, 0);
+    if (nonBlocking) {
+      flags |= O_NONBLOCK;
+    } else {
+      flags &= ~O_NONBLOCK;
+    }
+    if (flags < 0 || fcntl(sockFd, F_SETFL, flags) < 0) {
+      throw SocketError("could not change blocking mode");
+    }
+}
+
 void MySocket::close(void) {
     if(sockFd<0) return;
     
@@ -9,10 +9,16 @@
 class HTTPClientResponse {
  public:
   HTTPClientResponse(MySocket *sock);    
+  // Reads one response: its headers, then Content-Length bytes of body,
+  // or everything up to EOF if there is no Content-Length.
   std::string readResponse();
   int status() { return m_status_code; }
   bool success() { return m_status_code >= 200 && m_status_code < 300; }
   std::string body() { return m_body; }
+  // header names are lower case, "" if the header is missing
+  std::string header(std::string name);
+  // whether the server left the connection open for another request
+  bool keepAlive();
   
  protected:
   MySocket *m_sock;
@@ -20,6 +26,7 @@ class HTTPClientResponse {
   std::map<std::string, std::string> m_headers;
   int m_status_code;
   std::string m_status_message;
+  std::string m_http_version;
 };
 
 #endif
@@ -19,6 +19,9 @@ class HttpClient {
    *
    * Note: this call will block while establishing a connection.
    *
+   * The connection is kept alive and reused for later requests, and
+   * reopened when the server closes it.
+   *
    * @param inetAddr either ip address, or the domain name
    * @param port the port to connect to
    */
@@ -98,8 +101,14 @@ class HttpClient {
   HTTPClientResponse *read_response();
   
  private:
+  HTTPClientResponse *send_request(std::string path, std::string method, std::string body);
+
   MySocket *connection;
   std::map<std::string, std::string> headers;
+  std::string address;
+  int port;
+  // whether connection has carried a request already
+  bool reused;
 };
   
 
@@ -52,6 +52,14 @@ class MySocket {
   virtual std::string read();
   virtual void write(std::string data);
   virtual void close(void);
+
+  int getFd() { return sockFd; }
+  // non-blocking sockets are for event loops, read and write expect a
+  // blocking one
+  void setNonBlocking(bool nonBlocking);
+  // writes what a non-blocking socket takes right now: the number of
+  // bytes, 0 if it would block
+  int write_some(const void *buffer, int len);
   
  protected:
   void call_connect(const char *inetAddr, int port);
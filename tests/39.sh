@@ -0,0 +1,26 @@
+#!/bin/bash
+set -e
+
+# An image whose last commit reached the journal but not the blocks' home
+# locations: the home blocks from before the commit, the journal from
+# after it. Opening it replays the commit.
+journal=$(./mkfs -f test.img -i 32 -d 64 -j 16 | awk '/journal address/ {print $3}')
+./ds3ls test.img / > /dev/null
+cp test.img test-before.img
+./ds3touch test.img 0 replayed.txt
+dd if=test.img of=test-before.img bs=4096 skip=$((journal + 1)) seek=$((journal + 1)) count=15 conv=notrunc status=none
+cp test-before.img test-torn.img
+
+echo "journal replayed:"
+./ds3ls test-before.img /
+./ds3bits test-before.img
+
+# the same commit torn by a crash while its first new block was being
+# written to the journal. Its checksum does not match, so it is dropped
+# and the image stays as it was before
+dd if=/dev/zero of=test-torn.img bs=4096 seek=$((journal + 2)) count=1 conv=notrunc status=none
+echo "torn commit dropped:"
+./ds3ls test-torn.img /
+./ds3bits test-torn.img
+
+rm -f test.img test-before.img test-torn.img
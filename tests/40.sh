@@ -0,0 +1,55 @@
+#!/bin/bash
+set -e
+
+# Range GETs, a Content-Range PUT and a POST append against gunrock_web
+PORT=18040
+URL=http://localhost:$PORT/ds3/r/f.txt
+./mkfs -f test.img -i 32 -d 64 > /dev/null
+./gunrock_web -p $PORT -i test.img -d static > /dev/null 2>&1 &
+SERVER=$!
+trap "kill $SERVER; rm -f test.img" EXIT
+for i in $(seq 50); do
+    curl -s -o /dev/null http://localhost:$PORT/ && break
+    sleep 0.1
+done
+
+curl -s -X PUT --data-binary "0123456789" $URL -w " %{http_code}\n"
+
+echo "bytes=2-4:"
+curl -s -H "Range: bytes=2-4" $URL -D - | grep -E "^HTTP|^Content-Range|^Content-Length" | tr -d '\r'
+curl -s -H "Range: bytes=2-4" $URL -w " %{http_code}\n"
+echo "bytes=-3:"
+curl -s -H "Range: bytes=-3" $URL -w " %{http_code}\n"
+echo "bytes=7-:"
+curl -s -H "Range: bytes=7-" $URL -w " %{http_code}\n"
+echo "bytes=20- (unsatisfiable):"
+curl -s -H "Range: bytes=20-" $URL -D - -o /dev/null | grep -E "^HTTP|^Content-Range" | tr -d '\r'
+
+echo "partial PUT of bytes 3-5:"
+curl -s -X PUT -H "Content-Range: bytes 3-5/*" --data-binary "XYZ" $URL -w " %{http_code}\n"
+curl -s $URL -w " %{http_code}\n"
+echo "partial PUT whose range does not match its body:"
+curl -s -X PUT -H "Content-Range: bytes 3-9/*" --data-binary "XYZ" $URL -w " %{http_code}\n"
+curl -s $URL -w " %{http_code}\n"
+
+echo "POST append:"
+curl -s -X POST --data-binary "abc" $URL -w " %{http_code}\n"
+curl -s $URL -w " %{http_code}\n"
+curl -s -X POST --data-binary "new" http://localhost:$PORT/ds3/r/g.txt -w " %{http_code}\n"
+curl -s http://localhost:$PORT/ds3/r/g.txt -w " %{http_code}\n"
+
+echo "disk full, a Content-Range PUT far past the end:"
+head -c $((57 * 4096)) /dev/zero | curl -s -X PUT --data-binary @- http://localhost:$PORT/ds3/r/filler -w " %{http_code}\n"
+curl -s -X PUT -H "Content-Range: bytes 400000-400009/*" --data-binary "0123456789" $URL -w " %{http_code}\n"
+curl -s $URL | wc -c
+curl -s -H "Range: bytes=0-12" $URL -w " %{http_code}\n"
+
+kill $SERVER
+wait $SERVER || true
+trap "rm -f test.img" EXIT
+echo "disk full, growing a file with truncate:"
+./ds3ls test.img /ds3/r
+./ds3truncate test.img 4 400000 2>&1 || true
+./ds3cat test.img 4
+echo
+./ds3bits test.img | tail -2
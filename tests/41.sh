@@ -0,0 +1,59 @@
+#!/bin/bash
+set -e
+
+# Range GETs and partial PUTs that cross block boundaries on an extent image
+PORT=18041
+URL=http://localhost:$PORT/ds3/big.bin
+./mkfs -f test.img -i 32 -d 256 -V 2 > /dev/null
+./gunrock_web -p $PORT -i test.img -d static > /dev/null 2>&1 &
+SERVER=$!
+trap "kill $SERVER; rm -f test.img big.bin" EXIT
+for i in $(seq 50); do
+    curl -s -o /dev/null http://localhost:$PORT/ && break
+    sleep 0.1
+done
+
+# 5 blocks and a bit, every byte telling its own offset
+for i in $(seq 0 2100); do printf "%09d\n" $((i * 10)); done > big.bin
+curl -s -X PUT --data-binary @big.bin $URL -w " %{http_code}\n"
+curl -s $URL | cmp - big.bin && echo "whole file matches"
+
+echo "range across the first block boundary:"
+curl -s -H "Range: bytes=4090-4109" $URL -w " %{http_code}\n"
+echo
+echo "range across the last block boundary :"
+curl -s -H "Range: bytes=20470-20489" $URL -w " %{http_code}\n"
+echo
+echo "bytes=21010- (unsatisfiable):"
+curl -s -H "Range: bytes=21010-" $URL -D - -o /dev/null | grep -E "^HTTP|^Content-Range" | tr -d '\r'
+
+echo "partial PUT across two blocks:"
+curl -s -X PUT -H "Content-Range: bytes 8190-8199/*" --data-binary "ABCDEFGHIJ" $URL -w " %{http_code}\n"
+curl -s -H "Range: bytes=8180-8209" $URL -w " %{http_code}\n"
+echo
+echo "partial PUT past the end:"
+curl -s -X PUT -H "Content-Range: bytes 21010-21019/*" --data-binary "0123456789" $URL -w " %{http_code}\n"
+curl -s -H "Range: bytes=21000-" $URL -w " %{http_code}\n"
+echo
+
+echo "POST append to a new block:"
+head -c 4096 big.bin | curl -s -X POST --data-binary @- $URL -w " %{http_code}\n"
+curl -s -H "Range: bytes=-20" $URL -w " %{http_code}\n"
+echo
+curl -s $URL | wc -c
+
+echo "disk full, a Content-Range PUT far past the end:"
+head -c $((246 * 4096)) /dev/zero | curl -s -X PUT --data-binary @- http://localhost:$PORT/ds3/filler -w " %{http_code}\n"
+curl -s -X PUT -H "Content-Range: bytes 900000-900009/*" --data-binary "0123456789" $URL -w " %{http_code}\n"
+curl -s $URL | wc -c
+curl -s -H "Range: bytes=25100-25115" $URL -w " %{http_code}\n"
+echo
+
+kill $SERVER
+wait $SERVER || true
+trap "rm -f test.img big.bin" EXIT
+./ds3ls test.img /ds3
+./ds3bits test.img
+echo "disk full, growing a file with truncate:"
+./ds3truncate test.img 2 900000 2>&1 || true
+./ds3bits test.img | tail -2
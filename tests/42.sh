@@ -0,0 +1,22 @@
+#!/bin/bash
+set -e
+
+# Two pipelined requests on one kept-alive connection
+PORT=18042
+./mkfs -f test.img -i 32 -d 64 > /dev/null
+./gunrock_web -p $PORT -i test.img -d static -k 5 > /dev/null 2>&1 &
+SERVER=$!
+trap "kill $SERVER; rm -f test.img" EXIT
+for i in $(seq 50); do
+    curl -s -o /dev/null http://localhost:$PORT/ && break
+    sleep 0.1
+done
+curl -s -X PUT --data-binary "0123456789" http://localhost:$PORT/ds3/a.txt -w " %{http_code}\n"
+
+# both requests go out before either response is read, the second one
+# closes the connection
+exec 3<>/dev/tcp/localhost/$PORT
+printf "GET /ds3/a.txt HTTP/1.1\r\nHost: localhost\r\n\r\nGET /ds3/a.txt HTTP/1.1\r\nHost: localhost\r\nRange: bytes=2-4\r\nConnection: close\r\n\r\n" >&3
+timeout 10 cat <&3 | tr -d '\r'
+echo
+exec 3<&-